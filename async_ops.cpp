@@ -0,0 +1,231 @@
+#include "async_ops.h"
+
+using namespace std;
+
+Executor::Executor(size_t threads) {
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; ++i) workers.emplace_back([this] { run(); });
+}
+
+Executor::~Executor() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers) t.join();
+}
+
+void Executor::post(function<void()> job) {
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+}
+
+void Executor::run() {
+    while (true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> guard(lock);
+            cv.wait(guard, [&] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
+
+IoThread::IoThread() : worker([this] { run(); }) {}
+
+IoThread::~IoThread() {
+    drain();
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void IoThread::post(function<void()> job) {
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+}
+
+void IoThread::drain() {
+    if (this_thread::get_id() == worker.get_id()) return;
+    unique_lock<mutex> guard(lock);
+    idle.wait(guard, [&] { return jobs.empty() && !busy; });
+}
+
+void IoThread::run() {
+    while (true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> guard(lock);
+            cv.wait(guard, [&] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            busy = true;
+        }
+        job();
+        {
+            lock_guard<mutex> guard(lock);
+            busy = false;
+            if (jobs.empty()) idle.notify_all();
+        }
+    }
+}
+
+Pipeline::Pipeline(Database &db, size_t workers) : db(db), exec(workers) {
+    db.setIoThread(&io);
+}
+
+Pipeline::~Pipeline() {
+    io.drain();
+    db.setIoThread(nullptr);
+}
+
+void Pipeline::persistWallets(vector<LogEntry> log, vector<IdempotencyRecord> keys) {
+    uint64_t version = ++walletsVersion;
+    // Stamped now, when the change was applied, not when the IO thread gets
+    // to it.
+    time_t when = Env::now();
+    for (IdempotencyRecord &k : keys) unsavedKeys.push_back(std::move(k));
+    io.post([this, version, when, log = std::move(log)] {
+        Database::writeLog(log, when);
+        // Only the newest queued rewrite serializes the changed shards. Every
+        // change up to it has had its log lines written by now, so the wallet
+        // files are never ahead of the log, and the shards it commits together
+        // hold every change made so far, both sides of each transfer included.
+        // The keys of those changes go into the same commit, so a key is
+        // never lost while its change is on disk, and so do files such as
+        // schedules.db that record what the changes were for.
+        vector<ShardSet::File> files;
+        vector<IdempotencyRecord> keys;
+        {
+            lock_guard<mutex> guard(lock);
+            if (version == walletsVersion) {
+                files = db.serializeChangedWallets();
+                keys.swap(unsavedKeys);
+                for (ShardSet::File &f : unsavedFiles) files.push_back(std::move(f));
+                unsavedFiles.clear();
+            }
+        }
+        if (!files.empty() || !keys.empty()) {
+            Metrics::ScopedTimer timer(Metrics::SaveWallets);
+            db.shards.commit(std::move(files), IdempotencyCache::serialize(keys));
+        }
+        db.idempotency.persist(keys);
+    });
+}
+
+ShardSet::File *Pipeline::unsavedFile(const string &path) {
+    for (ShardSet::File &f : unsavedFiles)
+        if (f.path == path) return &f;
+    return nullptr;
+}
+
+void Pipeline::attach(const string &path, string content) {
+    if (ShardSet::File *f = unsavedFile(path)) f->content = std::move(content);
+    else unsavedFiles.push_back({ShardSet::Wallets, 0, std::move(content), path});
+}
+
+void Pipeline::persistUsers() {
+    uint64_t version = ++usersVersion;
+    io.post([this, version] {
+        vector<ShardSet::File> files;
+        {
+            lock_guard<mutex> guard(lock);
+            if (version != usersVersion) return;
+            files = db.serializeUsers();
+        }
+        Metrics::ScopedTimer timer(Metrics::SaveUsers);
+        db.shards.commit(std::move(files));
+    });
+}
+
+Task<bool> Pipeline::movePoints(uint64_t fingerprint, string key, function<bool(vector<LogEntry> &)> apply) {
+    co_await exec.schedule();
+    lock_guard<mutex> guard(lock);
+    // Checked under the lock, so a retry racing the original waits for it
+    // and then finds its key.
+    bool result;
+    if (db.replayed(key, fingerprint, result)) co_return result;
+    vector<LogEntry> log;
+    if (!apply(log)) co_return false;
+    vector<IdempotencyRecord> keys;
+    if (!key.empty()) keys.push_back(db.idempotency.remember(Database::clientKey(key), fingerprint, Env::now()));
+    persistWallets(std::move(log), std::move(keys));
+    co_return true;
+}
+
+Task<bool> Pipeline::transfer(int from, int to, long long amount, string key) {
+    return movePoints(Database::transferFingerprint(from, to, amount), std::move(key),
+                      [this, from, to, amount](vector<LogEntry> &log) { return db.applyTransfer(from, to, amount, log); });
+}
+
+Task<bool> Pipeline::topUp(int wallet_id, long long amount, string key) {
+    return movePoints(Database::topUpFingerprint(wallet_id, amount), std::move(key),
+                      [this, wallet_id, amount](vector<LogEntry> &log) { return db.applyTopUp(wallet_id, amount, log); });
+}
+
+Task<TopUpApproval> Pipeline::approveTopUps(function<bool(const TopUpRequest &)> select) {
+    co_await exec.schedule();
+    vector<TopUpRequest> all = co_await onIo([this] { return db.loadTopUpRequests(); });
+
+    lock_guard<mutex> guard(lock);
+    vector<LogEntry> log;
+    vector<TopUpRequest> pending;
+    vector<IdempotencyRecord> keys;
+    TopUpApproval result = db.applyTopUpApproval(all, select, log, pending, keys);
+    // The approved requests leave topup_requests.db in the commit that
+    // saves their credits, whichever queued job ends up making it.
+    attach("topup_requests.db", Database::serializeTopUpRequests(pending));
+    persistWallets(std::move(log), std::move(keys));
+    co_return result;
+}
+
+Task<bool> Pipeline::updateProfile(string username, string full_name) {
+    co_await exec.schedule();
+    lock_guard<mutex> guard(lock);
+    auto it = db.users.find(username);
+    if (it == db.users.end()) co_return false;
+    db.setFullName(it->second, full_name);
+    persistUsers();
+    co_return true;
+}
+
+Task<ScheduleRun> Pipeline::runSchedule(Scheduler &scheduler, time_t now) {
+    co_await exec.schedule();
+    lock_guard<mutex> guard(lock);
+    vector<LogEntry> log;
+    ScheduleRun run = scheduler.runDue(now, db, log);
+    if (run.orders == 0) co_return run;
+    attach(scheduler.path(), scheduler.serialize());
+    persistWallets(std::move(log));
+    co_return run;
+}
+
+Task<void> Pipeline::saveSchedule(Scheduler &scheduler) {
+    co_await exec.schedule();
+    lock_guard<mutex> guard(lock);
+    // Written on its own, it could land before that commit and be
+    // overwritten by the older state.
+    if (ShardSet::File *f = unsavedFile(scheduler.path())) {
+        f->content = scheduler.serialize();
+        co_return;
+    }
+    io.post([path = scheduler.path(), state = scheduler.serialize()] { Scheduler::writeFile(path, state); });
+}
+
+Task<void> Pipeline::flush() {
+    co_await onIo([] { return true; });
+}
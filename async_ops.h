@@ -0,0 +1,265 @@
+#pragma once
+
+// Coroutine pipeline for the core operations.
+//
+// Business logic (validate, move points, record history) runs as C++20
+// coroutine tasks on a small Executor. Disk writes are handed to a single
+// IoThread and are not awaited, so a session can issue its next operation
+// while earlier writes are still being persisted; IoThread::drain() and
+// Pipeline::flush() are the points where a caller waits for the disk.
+//
+// Writes run strictly in submission order. Consecutive wallet / user file
+// rewrites collapse into the newest one, so a burst of transfers costs one
+// commit of the shards it touched rather than one per transfer. The I/O backend is a plain
+// thread; io_uring would need liburing, which is not part of this tree.
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "scheduler.h"
+#include "wallet_core.h"
+
+template <class T>
+class Task;
+
+namespace detail {
+
+struct TaskState {
+    std::mutex lock;
+    std::condition_variable cv;
+    bool done = false;
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+struct TaskPromiseBase : TaskState {
+    // Tasks start running as soon as they are created; the first thing an
+    // operation does is hop onto the executor.
+    std::suspend_never initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            TaskState &s = h.promise();
+            std::coroutine_handle<> next;
+            {
+                // Notify under the lock: a thread blocked in Task::get() may
+                // destroy the frame as soon as it gets the lock back.
+                std::lock_guard<std::mutex> guard(s.lock);
+                s.done = true;
+                next = s.continuation;
+                s.cv.notify_all();
+            }
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <class T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    void return_value(T v) { value.emplace(std::move(v)); }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+};
+
+} // namespace detail
+
+// Result of a coroutine operation. Either co_await it from another task or
+// block on get(). Destroying an unfinished task waits for it.
+template <class T>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle h) : h(h) {}
+    Task(Task &&other) noexcept : h(std::exchange(other.h, {})) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        if (!h) return;
+        wait();
+        h.destroy();
+    }
+
+    T get() {
+        wait();
+        return result();
+    }
+
+    bool await_ready() {
+        std::lock_guard<std::mutex> guard(h.promise().lock);
+        return h.promise().done;
+    }
+    bool await_suspend(std::coroutine_handle<> c) {
+        std::lock_guard<std::mutex> guard(h.promise().lock);
+        if (h.promise().done) return false;
+        h.promise().continuation = c;
+        return true;
+    }
+    T await_resume() { return result(); }
+
+private:
+    Handle h;
+
+    void wait() {
+        std::unique_lock<std::mutex> guard(h.promise().lock);
+        h.promise().cv.wait(guard, [&] { return h.promise().done; });
+    }
+    T result() {
+        if (h.promise().error) std::rethrow_exception(h.promise().error);
+        if constexpr (!std::is_void_v<T>) return std::move(*h.promise().value);
+    }
+};
+
+namespace detail {
+
+template <class T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+// Fixed pool of worker threads.
+class Executor {
+public:
+    explicit Executor(size_t threads = 2);
+    ~Executor();
+
+    void post(std::function<void()> job);
+
+    // co_await executor.schedule() continues the coroutine on a worker.
+    auto schedule() {
+        struct Awaiter {
+            Executor &exec;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { exec.post([h] { h.resume(); }); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> jobs;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void run();
+};
+
+// The one thread that touches the database files on behalf of the pipeline.
+class IoThread {
+public:
+    IoThread();
+    ~IoThread();
+
+    void post(std::function<void()> job);
+    // Blocks until every job posted so far has finished. Called from the I/O
+    // thread itself it returns at once, since those jobs are already ordered.
+    void drain();
+
+private:
+    std::mutex lock;
+    std::condition_variable cv;
+    std::condition_variable idle;
+    std::deque<std::function<void()>> jobs;
+    bool busy = false;
+    bool stopping = false;
+    std::thread worker;
+
+    void run();
+};
+
+class Pipeline {
+public:
+    explicit Pipeline(Database &db, size_t workers = 2);
+    ~Pipeline();
+
+    // A non-empty key makes the call idempotent, see Database::transfer.
+    Task<bool> transfer(int from, int to, long long amount, std::string key = "");
+    Task<bool> topUp(int wallet_id, long long amount, std::string key = "");
+    Task<TopUpApproval> approveTopUps(std::function<bool(const TopUpRequest &)> select);
+    Task<bool> updateProfile(std::string username, std::string full_name);
+
+    // Runs the standing orders due by now. Their payouts go to disk as one
+    // batch: the log lines, then a single commit of the wallet shards and
+    // schedules.db, so a crash cannot keep the payouts but lose the advanced
+    // next-run times and pay them again.
+    Task<ScheduleRun> runSchedule(Scheduler &scheduler, time_t now);
+    // Queues a schedules.db rewrite behind the writes already queued, or
+    // hands it to the wallet commit still to come that holds an older one.
+    Task<void> saveSchedule(Scheduler &scheduler);
+
+    // Completes once everything submitted before it is on disk.
+    Task<void> flush();
+
+private:
+    Database &db;
+    std::mutex lock;  // guards db while an operation runs
+    uint64_t walletsVersion = 0;
+    uint64_t usersVersion = 0;
+    std::vector<IdempotencyRecord> unsavedKeys;  // of changes no commit has saved yet
+    std::vector<ShardSet::File> unsavedFiles;    // outside the tables, for the same commit
+    Executor exec;
+    IoThread io;
+
+    // Runs f on the I/O thread and resumes the coroutine on the executor.
+    template <class F>
+    auto onIo(F f) {
+        using R = std::invoke_result_t<F>;
+        struct Awaiter {
+            Pipeline &p;
+            F f;
+            std::optional<R> result;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) {
+                p.io.post([this, h] {
+                    result.emplace(f());
+                    p.exec.post([h] { h.resume(); });
+                });
+            }
+            R await_resume() { return std::move(*result); }
+        };
+        return Awaiter{*this, std::move(f), std::nullopt};
+    }
+
+    // Queues the log lines, then a commit of the changed wallet shards with
+    // the idempotency keys and unsavedFiles. Must be called with lock held so
+    // queued writes follow the order of the changes.
+    void persistWallets(std::vector<LogEntry> log, std::vector<IdempotencyRecord> keys = {});
+    void persistUsers();
+    // The entry of unsavedFiles for path, or null. Needs lock.
+    ShardSet::File *unsavedFile(const std::string &path);
+    // Sets path's content for the next wallet commit. Needs lock.
+    void attach(const std::string &path, std::string content);
+
+    // Shared body of transfer and topUp.
+    Task<bool> movePoints(uint64_t fingerprint, std::string key,
+                          std::function<bool(std::vector<LogEntry> &)> apply);
+};
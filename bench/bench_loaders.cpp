@@ -0,0 +1,172 @@
+// Throughput comparison between the original stream-based loaders and
+// TextLoader. Generates synthetic database files in a scratch directory under
+// the system temp directory, so real data in the working directory is never
+// touched, checks that both parsers produce identical records and prints
+// MB/s. The scratch directory is removed afterwards.
+//
+//   g++ -std=c++17 -O2 bench/bench_loaders.cpp -o bench_loaders
+//   ./bench_loaders [records]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../text_loader.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+using UserRec = tuple<string, size_t, string, bool, int, bool>;
+using WalletRec = pair<int, long long>;
+using TopUpRec = tuple<string, int, long long, time_t>;
+using UpdateRec = tuple<string, string, string>;
+
+static void generate(size_t n) {
+    mt19937_64 rng(42);
+    ofstream u("users.db"), w("wallets.db"), t("topup_requests.db"), a("admin_update_requests.db");
+    for (size_t i = 0; i < n; ++i) {
+        u << "user" << i << ' ' << rng() << " Name" << i << ' ' << (i % 50 == 0) << ' ' << i + 1 << ' ' << (i % 7 == 0) << '\n';
+        w << i << ' ' << static_cast<long long>(rng() % 10000000) << '\n';
+        t << "REQ" << i << ' ' << rng() % n << ' ' << rng() % 100000 << ' ' << 1700000000 + i << '\n';
+        a << "OTP" << i << "|user" << i << "|New Name " << i << '\n';
+    }
+}
+
+// The loaders as they were before TextLoader.
+static vector<UserRec> streamUsers() {
+    vector<UserRec> out;
+    ifstream ifs("users.db");
+    string uname, fname;
+    size_t pwd_hash;
+    bool admin, force;
+    int wid;
+    while (ifs >> uname >> pwd_hash >> fname >> admin >> wid >> force)
+        out.emplace_back(uname, pwd_hash, fname, admin, wid, force);
+    return out;
+}
+
+static vector<WalletRec> streamWallets() {
+    vector<WalletRec> out;
+    ifstream ifs("wallets.db");
+    int id;
+    long long bal;
+    while (ifs >> id >> bal) out.emplace_back(id, bal);
+    return out;
+}
+
+static vector<TopUpRec> streamTopUps() {
+    vector<TopUpRec> out;
+    ifstream req("topup_requests.db");
+    string line;
+    while (getline(req, line)) {
+        istringstream iss(line);
+        string request_id;
+        int wallet_id;
+        long long amt;
+        time_t t;
+        if (iss >> request_id >> wallet_id >> amt >> t) out.emplace_back(request_id, wallet_id, amt, t);
+    }
+    return out;
+}
+
+static vector<UpdateRec> streamUpdates() {
+    vector<UpdateRec> out;
+    ifstream fin("admin_update_requests.db");
+    string line;
+    while (getline(fin, line)) {
+        stringstream ss(line);
+        string otp, username, fullname;
+        getline(ss, otp, '|');
+        getline(ss, username, '|');
+        getline(ss, fullname);
+        out.emplace_back(otp, username, fullname);
+    }
+    return out;
+}
+
+static vector<UserRec> fastUsers() {
+    vector<UserRec> out;
+    string buf;
+    TextLoader::readFile("users.db", buf);
+    TextLoader::forEachUser(buf, [&](string_view u, size_t h, string_view f, bool a, int w, bool force) {
+        out.emplace_back(string(u), h, string(f), a, w, force);
+    });
+    return out;
+}
+
+static vector<WalletRec> fastWallets() {
+    vector<WalletRec> out;
+    string buf;
+    TextLoader::readFile("wallets.db", buf);
+    TextLoader::forEachWallet(buf, [&](int id, long long bal) { out.emplace_back(id, bal); });
+    return out;
+}
+
+static vector<TopUpRec> fastTopUps() {
+    vector<TopUpRec> out;
+    string buf;
+    TextLoader::readFile("topup_requests.db", buf);
+    TextLoader::forEachTopUp(buf, [&](string_view r, int w, long long amt, time_t t) {
+        out.emplace_back(string(r), w, amt, t);
+    });
+    return out;
+}
+
+static vector<UpdateRec> fastUpdates() {
+    vector<UpdateRec> out;
+    string buf;
+    TextLoader::readFile("admin_update_requests.db", buf);
+    TextLoader::forEachUpdateRequest(buf, [&](string_view, string_view o, string_view u, string_view f) {
+        out.emplace_back(string(o), string(u), string(f));
+    });
+    return out;
+}
+
+template <class F>
+static double seconds(F &&f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static size_t fileSize(const char *path) {
+    ifstream ifs(path, ios::ate | ios::binary);
+    return ifs ? static_cast<size_t>(ifs.tellg()) : 0;
+}
+
+template <class SF, class FF>
+static bool compare(const char *name, const char *path, SF streamLoad, FF fastLoad) {
+    decltype(streamLoad()) a, b;
+    double ts = seconds([&] { a = streamLoad(); });
+    double tf = seconds([&] { b = fastLoad(); });
+    double mb = fileSize(path) / (1024.0 * 1024.0);
+    bool same = a == b;
+    printf("%-16s %10zu records  stream %8.1f MB/s  fast %8.1f MB/s  x%5.1f  %s\n",
+           name, a.size(), mb / ts, mb / tf, ts / tf, same ? "identical" : "MISMATCH");
+    return same;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    fs::path dir = fs::temp_directory_path() / "bench_loaders";
+    fs::path home = fs::current_path();
+    fs::create_directories(dir);
+    fs::current_path(dir);
+    generate(n);
+    bool ok = true;
+    ok &= compare("users", "users.db", streamUsers, fastUsers);
+    ok &= compare("wallets", "wallets.db", streamWallets, fastWallets);
+    ok &= compare("topup_requests", "topup_requests.db", streamTopUps, fastTopUps);
+    ok &= compare("update_requests", "admin_update_requests.db", streamUpdates, fastUpdates);
+    fs::current_path(home);
+    fs::remove_all(dir);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,321 @@
+// Micro-benchmarks for the wallet hot paths. Generates synthetic datasets in
+// a scratch directory, times the core Database operations and writes the
+// results as JSON so runs can be compared across builds.
+//
+//   wallet_bench [--wallets 1000,100000,1000000] [--log-lines 1000000]
+//                [--log-appends 100000] [--shards 1] [--dir bench_data]
+//                [--out bench_results.json]
+//
+// The defaults finish in well under a minute; pass e.g.
+// --wallets 1000,10000,100000,1000000,10000000 --log-lines 100000000 for the
+// full-size run.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "async_ops.h"
+#include "transaction_log.h"
+#include "wallet_core.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct Result {
+    string name;
+    size_t wallets;
+    size_t iterations;
+    double total_ns;
+};
+
+static vector<Result> results;
+
+// Runs f(i) for i in [0, calls) and records the time per operation, where
+// each call accounts for opsPerCall operations.
+template <class F>
+static void measure(const string &name, size_t wallets, size_t calls, F &&f, size_t opsPerCall = 1) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i) f(i);
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    size_t ops = calls * opsPerCall;
+    results.push_back({name, wallets, ops, ns});
+    printf("%-24s wallets=%-9zu ops=%-10zu %12.0f ns/op\n", name.c_str(), wallets, ops, ns / ops);
+    fflush(stdout);
+}
+
+// Repeats whole-table operations fewer times as the table grows.
+static size_t repsFor(size_t n, size_t budget, size_t cap) {
+    return max<size_t>(1, min(cap, budget / max<size_t>(n, 1)));
+}
+
+static void writeDataset(size_t n, mt19937_64 &rng) {
+    ofstream u("users.db", ios::trunc), w("wallets.db", ios::trunc);
+    w << 0 << ' ' << 1000000000000LL << '\n';
+    for (size_t i = 1; i <= n; ++i) {
+        u << "user" << i << ' ' << rng() << " Name" << i << ' ' << 0 << ' ' << i << ' ' << 0 << '\n';
+        w << i << ' ' << 1000000 << '\n';
+    }
+}
+
+static void writeTopUpRequests(size_t count, size_t n, mt19937_64 &rng) {
+    ofstream t("topup_requests.db", ios::trunc);
+    for (size_t i = 0; i < count; ++i)
+        t << "REQ" << i << ' ' << 1 + rng() % n << ' ' << 1 + rng() % 1000 << ' ' << 1700000000 + i << '\n';
+}
+
+// Writes one line per second starting at 2024-01-01 00:00:00, sealing a
+// segment every time the active file reaches the configured size.
+static void writeTransactionLog(size_t lines, size_t n, mt19937_64 &rng) {
+    TransactionLog &log = transactionLog();
+    uint64_t limit = log.config().maxSegmentBytes;
+    time_t base = 1704067200;
+    ofstream logf(log.config().activePath, ios::trunc);
+    uint64_t written = 0;
+    for (size_t i = 0; i < lines; ++i) {
+        time_t t = base + static_cast<time_t>(i);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", gmtime(&t));
+        size_t a = 1 + rng() % n, b = 1 + rng() % n;
+        int len = snprintf(nullptr, 0, "[%s] Wallet %zu: Sent 10 to %zu\n", stamp, a, b);
+        logf << '[' << stamp << "] Wallet " << a << ": Sent 10 to " << b << '\n';
+        written += static_cast<uint64_t>(len);
+        if (written >= limit) {
+            logf.close();
+            log.seal();
+            logf.open(log.config().activePath, ios::trunc);
+            written = 0;
+        }
+    }
+}
+
+static void benchDataset(size_t n, size_t logLines, size_t logAppends) {
+    mt19937_64 rng(n);
+    writeDataset(n, rng);
+    remove("transaction.db");
+    remove("idempotency.db");
+
+    {
+        Database *d = nullptr;
+        measure("cold_load", n, 1, [&](size_t) { d = new Database(); });
+        delete d;  // renames users.db/wallets.db to *_backup.db
+    }
+    writeDataset(n, rng);
+    Database db;
+    // The transfer benchmarks reuse wallets far faster than any user could.
+    db.limits.transfers.configure({});
+
+    measure("loadUsers", n, repsFor(n, 20000000, 50), [&](size_t) { db.loadUsers(); });
+    measure("loadWallets", n, repsFor(n, 20000000, 50), [&](size_t) { db.loadWallets(); });
+    // A save after one balance change, which rewrites only that wallet's shard.
+    measure("saveWallets", n, repsFor(n, 20000000, 50), [&](size_t) {
+        db.addWallet(1 + rng() % n, 1000000);
+        db.saveWallets();
+    });
+
+    measure("transfer", n, repsFor(n, 20000000, 2000), [&](size_t) {
+        db.transfer(1 + rng() % n, 1 + rng() % n, 1);
+    });
+
+    // Same transfers through the coroutine pipeline: the session waits for
+    // the business logic only, and queued wallet rewrites collapse.
+    {
+        Pipeline pipeline(db);
+        size_t calls = repsFor(n, 200000000, 20000);
+        measure("pipeline_transfer", n, calls, [&](size_t i) {
+            pipeline.transfer(1 + rng() % n, 1 + rng() % n, 1).get();
+            if (i + 1 == calls) pipeline.flush().get();
+        });
+
+        // Keyed transfers, then the same keys again: a retry is answered
+        // from the idempotency cache without touching any wallet.
+        vector<pair<int, int>> moves(calls);
+        for (auto &m : moves) m = {static_cast<int>(1 + rng() % n), static_cast<int>(1 + rng() % n)};
+        auto keyed = [&](size_t i) {
+            return pipeline.transfer(moves[i].first, moves[i].second, 1, "bench-" + to_string(i)).get();
+        };
+        measure("pipeline_transfer_keyed", n, calls, [&](size_t i) {
+            keyed(i);
+            if (i + 1 == calls) pipeline.flush().get();
+        });
+        measure("pipeline_transfer_retry", n, calls, [&](size_t i) { keyed(i); });
+    }
+
+    // Taking a reporting snapshot, and transfers while one is held, which
+    // pay for copying the chunks they touch.
+    measure("snapshot", n, repsFor(n, 200000000, 100000), [&](size_t) { db.snapshot(); });
+    {
+        Snapshot held = db.snapshot();
+        measure("transfer_apply_snapshot", n, 100000, [&](size_t i) {
+            vector<LogEntry> log;
+            db.applyTransfer(1 + rng() % n, 1 + rng() % n, 1, log);
+            if ((i & 1023) == 0) held = db.snapshot();
+        });
+    }
+
+    // The admin dashboard: running totals and the top balances.
+    measure("dashboard", n, 100000, [&](size_t) {
+        Snapshot snap = db.snapshot();
+        snap.totals();
+        snap.topBalances(10);
+    });
+
+    // Velocity check plus update on the hot path, spread over all wallets.
+    {
+        RateLimiter limiter({30, 1000000});
+        time_t now = time(nullptr);
+        measure("rate_limit", n, 1000000, [&](size_t i) {
+            int wid = static_cast<int>(1 + rng() % n);
+            if (limiter.check(wid, 10, now) == RateLimiter::Verdict::Allowed) limiter.record(wid, 10, now);
+            if ((i & 4095) == 0) now = time(nullptr);
+        });
+    }
+
+    size_t requests = min<size_t>(n, 10000);
+    writeTopUpRequests(requests, n, rng);
+    measure("approveTopUps", n, 1, [&](size_t) {
+        db.approveTopUps([](const TopUpRequest &) { return true; });
+    }, requests);
+
+    // One standing order paying every member from the central wallet: the
+    // whole payout is committed with one log append and one wallets.db write.
+    {
+        Pipeline pipeline(db);
+        Scheduler scheduler("bench_schedules.db", 1);
+        StandingOrder order;
+        order.to = StandingOrder::kAllMembers;
+        order.amount = 1;
+        order.period = StandingOrder::Daily;
+        order.start = 1;
+        scheduler.add(order);
+        size_t days = repsFor(n, 2000000, 20);
+        measure("scheduled_payout", n, days, [&](size_t i) {
+            pipeline.runSchedule(scheduler, 1 + static_cast<time_t>(i) * 86400).get();
+            if (i + 1 == days) pipeline.flush().get();
+        }, n);
+        remove("bench_schedules.db");
+    }
+
+    // Wallet::log and history lookups do not depend on the wallet count, so
+    // they only run for the first dataset.
+    static bool logDone = false;
+    if (logDone) return;
+    logDone = true;
+
+    remove("transaction.db");
+    Wallet &w = db.wallets.at(1);
+    measure("Wallet::log", n, logAppends, [&](size_t) { w.log("Sent 10 to 2"); });
+
+    // Cost of the instrumentation itself, to compare against "transfer".
+    measure("metrics_timer", n, 1000000, [&](size_t) { Metrics::ScopedTimer t(Metrics::Transfer); });
+
+    fs::remove_all(transactionLog().config().dir);
+    writeTransactionLog(logLines, n, rng);
+    size_t matched = 0;
+    measure("history_lookup", n, 1, [&](size_t) {
+        db.forEachTransaction(1, [&](string_view) { ++matched; });
+    }, logLines);
+
+    // The last hour of the synthetic log; older segments are skipped from the
+    // manifest alone.
+    time_t lastHour = 1704067200 + static_cast<time_t>(logLines) - 3600;
+    char from[32];
+    strftime(from, sizeof(from), "%Y%m%d%H%M%S", gmtime(&lastHour));
+    measure("history_lookup_1h", n, 1, [&](size_t) {
+        transactionLog().forEach(1, [&](string_view) { ++matched; }, strtoull(from, nullptr, 10));
+    }, logLines);
+
+    // The newest page of a wallet, which reads the active file backwards and
+    // stops once the page is full, and a whole-history CSV export.
+    measure("history_page", n, 1000, [&](size_t) { transactionLog().page(1, 20); });
+    uint64_t exported = 0;
+    measure("history_export_csv", n, 1, [&](size_t) {
+        exportHistory(transactionLog(), 1, "history.csv", ExportFormat::Csv, exported);
+    }, logLines);
+    remove("history.csv");
+
+    // Onboarding a batch of members with generated passwords, in one commit
+    // on top of the existing population.
+    vector<NewUser> batch(10000);
+    for (size_t i = 0; i < batch.size(); ++i) batch[i] = {"bulk" + to_string(i), "Bulk" + to_string(i), "", i + 1};
+    measure("provision_users", n, 1, [&](size_t) { db.provisionUsers(batch, "credentials.txt"); }, batch.size());
+    remove("credentials.txt");
+
+    uint64_t raw = 0, stored = 0;
+    for (const SegmentInfo &seg : transactionLog().segments()) {
+        raw += seg.raw_bytes;
+        stored += seg.stored_bytes;
+    }
+    if (stored) printf("log segments: %zu, %.1f MB raw, %.1f MB stored (%.1fx)\n",
+                       transactionLog().segments().size(), raw / 1e6, stored / 1e6, double(raw) / stored);
+}
+
+static void writeJson(const string &path, unsigned shards) {
+    ofstream out(path, ios::trunc);
+    out << "{\n  \"shards\": " << shards << ",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        double perOp = r.total_ns / r.iterations;
+        out << "    {\"name\": \"" << r.name << "\", \"wallets\": " << r.wallets
+            << ", \"iterations\": " << r.iterations << fixed << setprecision(1)
+            << ", \"total_ns\": " << r.total_ns << ", \"ns_per_op\": " << perOp
+            << ", \"ops_per_sec\": " << (perOp > 0 ? 1e9 / perOp : 0.0) << "}"
+            << (i + 1 < results.size() ? "," : "") << '\n';
+        out.unsetf(ios::floatfield);
+    }
+    out << "  ]\n}\n";
+}
+
+static vector<size_t> parseList(const string &s) {
+    vector<size_t> out;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) out.push_back(strtoull(item.c_str(), nullptr, 10));
+    return out;
+}
+
+int main(int argc, char **argv) {
+    vector<size_t> sizes = {1000, 100000, 1000000};
+    size_t logLines = 1000000;
+    size_t logAppends = 100000;
+    string dir = "bench_data";
+    string out = "bench_results.json";
+    unsigned shards = 1;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        string value = argv[i + 1];
+        if (flag == "--wallets") sizes = parseList(value);
+        else if (flag == "--log-lines") logLines = strtoull(value.c_str(), nullptr, 10);
+        else if (flag == "--log-appends") logAppends = strtoull(value.c_str(), nullptr, 10);
+        else if (flag == "--shards") shards = static_cast<unsigned>(strtoul(value.c_str(), nullptr, 10));
+        else if (flag == "--dir") dir = value;
+        else if (flag == "--out") out = value;
+        else {
+            cerr << "Unknown option " << flag << endl;
+            return 2;
+        }
+    }
+
+    fs::path outPath = fs::absolute(out);
+    fs::create_directories(dir);
+    fs::current_path(dir);
+    // Each dataset is written as users.db/wallets.db and split up when the
+    // Database opens it.
+    if (shards > 1) ofstream("shards.db", ios::trunc) << shards << '\n';
+    else remove("shards.db");
+
+    for (size_t n : sizes) benchDataset(n, logLines, logAppends);
+
+    writeJson(outPath.string(), max(shards, 1u));
+    cout << "Results written to " << outPath.string() << endl;
+    return 0;
+}
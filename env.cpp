@@ -0,0 +1,38 @@
+#include "env.h"
+
+#include <atomic>
+
+using namespace std;
+
+namespace {
+
+atomic<bool> manual{false};
+atomic<time_t> manualTime{0};
+
+} // namespace
+
+namespace Env {
+
+time_t now() {
+    return manual.load(memory_order_relaxed) ? manualTime.load(memory_order_relaxed) : time(nullptr);
+}
+
+void setTime(time_t t) {
+    manualTime.store(t, memory_order_relaxed);
+    manual.store(true, memory_order_relaxed);
+}
+
+void useSystemClock() {
+    manual.store(false, memory_order_relaxed);
+}
+
+mt19937 &rng() {
+    static mt19937 engine(static_cast<unsigned>(time(nullptr)));
+    return engine;
+}
+
+void seed(uint32_t s) {
+    rng().seed(s);
+}
+
+} // namespace Env
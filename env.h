@@ -0,0 +1,28 @@
+#pragma once
+
+// Where the core reads the time and draws random numbers.
+//
+// By default that is the wall clock and an engine seeded from it. A replay
+// (tools/wallet_loadgen.cpp) sets the clock by hand and seeds the engine
+// before it starts, so log stamps, rate limit windows, idempotency expiries,
+// OTPs and generated passwords come out the same on every run.
+
+#include <cstdint>
+#include <ctime>
+#include <random>
+
+namespace Env {
+
+// Seconds since the epoch: the wall clock, or the time last set.
+time_t now();
+
+// From now on now() returns t, until the next setTime or useSystemClock.
+void setTime(time_t t);
+void useSystemClock();
+
+// Engine behind OTPs and generated passwords. Not thread-safe, like the
+// menus that use it.
+std::mt19937 &rng();
+void seed(uint32_t s);
+
+} // namespace Env
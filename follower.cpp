@@ -0,0 +1,143 @@
+#include "follower.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+
+#include "text_loader.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// Hash of the first line, which tells a transaction.db we were reading apart
+// from the fresh one that replaced it when it was sealed.
+uint64_t headOf(string_view text) {
+    size_t nl = text.find('\n');
+    if (nl == string_view::npos) return 0;
+    uint64_t h = hash<string_view>()(text.substr(0, nl));
+    return h ? h : 1;
+}
+
+bool writeAtomically(const string &path, const string &content) {
+    string temp = path + ".tmp";
+    {
+        ofstream out(temp, ios::trunc);
+        out.write(content.data(), static_cast<streamsize>(content.size()));
+        if (!out) return false;
+    }
+    return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+} // namespace
+
+Follower::Follower(Config config) : cfg(std::move(config)), log(cfg.log) {
+    reset();
+}
+
+void Follower::reset() {
+    wallets.clear();
+    wallets[0] = 1000000;  // same starting point as a fresh Database
+    nextSeq = 1;
+    offset = 0;
+    head = 0;
+    applied = 0;
+}
+
+bool Follower::apply(string_view line, map<int, long long> &wallets) {
+    LogStamp ts;
+    int wid;
+    if (!TransactionLog::parseLine(line, ts, wid)) return false;
+    size_t colon = line.find(": ", 20);
+    if (colon == string_view::npos) return false;
+    TextLoader::Tokenizer t(line.substr(colon + 2));
+    string_view verb, amount;
+    long long amt;
+    if (!t.next(verb) || !t.next(amount) || !TextLoader::parseNumber(amount, amt)) return false;
+    if (verb == "Received") wallets[wid] += amt;
+    else if (verb == "Sent" || verb == "Debited") wallets[wid] -= amt;
+    else return false;
+    return true;
+}
+
+size_t Follower::applyText(string_view text, uint64_t from, uint64_t &end) {
+    // Only whole lines: the last one may still be half written.
+    size_t last = text.rfind('\n');
+    end = last == string_view::npos || last < from ? from : last + 1;
+    size_t n = 0;
+    if (end > from) {
+        TextLoader::forEachLine(text.substr(from, end - from), [&](string_view line) {
+            if (apply(line, wallets)) ++n;
+        });
+    }
+    applied += n;
+    return n;
+}
+
+size_t Follower::poll() {
+    size_t n = 0;
+    string buf;
+    uint64_t end;
+    for (const SegmentInfo &seg : log.segments()) {
+        if (seg.seq < nextSeq) continue;
+        if (!log.readSegment(seg, buf)) break;  // try again next poll
+        // The first new segment is usually the transaction.db we were part
+        // way through. If not, the file we were reading is still active.
+        bool ours = head != 0 && headOf(buf) == head;
+        n += applyText(buf, ours ? offset : 0, end);
+        if (ours) offset = head = 0;
+        nextSeq = seg.seq + 1;
+    }
+
+    if (!TextLoader::readFile(cfg.log.activePath.c_str(), buf)) return n;
+    uint64_t h = headOf(buf);
+    // A different first line means the file we were reading is being sealed
+    // and is not in the manifest yet; pick it up from there next time.
+    if (head != 0 && h != head) return n;
+    if (h == 0) return n;
+    n += applyText(buf, offset, end);
+    offset = end;
+    head = h;
+    return n;
+}
+
+bool Follower::load() {
+    reset();
+    string buf;
+    if (!TextLoader::readFile((fs::path(cfg.dir) / "follower.db").string().c_str(), buf)) return false;
+    bool first = true, ok = false;
+    TextLoader::forEachLine(buf, [&](string_view line) {
+        TextLoader::Tokenizer t(line);
+        if (first) {
+            // position <next segment> <offset> <head> <lines applied>
+            first = false;
+            string_view tag, seq, off, hd, lines;
+            ok = t.next(tag) && tag == "position" && t.next(seq) && t.next(off) && t.next(hd) && t.next(lines) &&
+                 TextLoader::parseNumber(seq, nextSeq) && TextLoader::parseNumber(off, offset) &&
+                 TextLoader::parseNumber(hd, head) && TextLoader::parseNumber(lines, applied);
+            if (ok) wallets.clear();
+            return;
+        }
+        string_view id, bal;
+        int wid;
+        long long balance;
+        if (ok && t.next(id) && t.next(bal) && TextLoader::parseNumber(id, wid) &&
+            TextLoader::parseNumber(bal, balance))
+            wallets[wid] = balance;
+    });
+    if (!ok) reset();
+    return ok;
+}
+
+bool Follower::save() const {
+    error_code ec;
+    fs::create_directories(cfg.dir, ec);
+    string table;
+    for (const auto &p : wallets) table += to_string(p.first) + " " + to_string(p.second) + "\n";
+    string state = "position " + to_string(nextSeq) + " " + to_string(offset) + " " + to_string(head) + " " +
+                   to_string(applied) + "\n" + table;
+    return writeAtomically((fs::path(cfg.dir) / "follower.db").string(), state) &&
+           writeAtomically((fs::path(cfg.dir) / "wallets.db").string(), table);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+// Follower copy of the wallet balances, kept in sync by tailing the
+// transaction log.
+//
+// Every change to a balance is in the log as a "Sent", "Received" or
+// "Debited" line of the wallet, so replaying the log from the start onto the
+// initial state (an empty table with the central wallet at 1,000,000)
+// rebuilds the balances. The follower remembers how far it got, as the next
+// sealed segment to read and a byte offset into transaction.db, and only
+// reads what was added since. Its state lives in <dir>/follower.db, which is
+// replaced atomically so the position and the balances always agree, and a
+// copy of the balances in the usual format goes to <dir>/wallets.db.
+//
+// Wallets that never moved points do not appear, and user records are not
+// followed: the log does not carry them.
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "transaction_log.h"
+
+class Follower {
+public:
+    struct Config {
+        std::string dir = "follower";
+        TransactionLog::Config log;
+    };
+
+    explicit Follower(Config config);
+
+    // Restores the state saved by save(). Returns false if there was none.
+    bool load();
+    // Applies the log lines written since the last poll. Returns how many.
+    size_t poll();
+    bool save() const;
+
+    const std::map<int, long long> &balances() const { return wallets; }
+    uint64_t linesApplied() const { return applied; }
+
+    // Applies one log line to the table. Returns false if it is not a
+    // balance change.
+    static bool apply(std::string_view line, std::map<int, long long> &wallets);
+
+private:
+    Config cfg;
+    TransactionLog log;
+    std::map<int, long long> wallets;
+    uint32_t nextSeq = 1;  // first sealed segment not read yet
+    uint64_t offset = 0;   // bytes of transaction.db already applied
+    uint64_t head = 0;     // hash of its first line, 0 if nothing read
+    uint64_t applied = 0;
+
+    size_t applyText(std::string_view text, uint64_t from, uint64_t &end);
+    void reset();
+};
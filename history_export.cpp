@@ -0,0 +1,77 @@
+#include "history_export.h"
+
+#include <fstream>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kBufferBytes = 1 << 20;
+
+void putLE(string &out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+// "[YYYY-MM-DD HH:MM:SS] Wallet <id>: <entry>" into its stamp text and entry.
+bool splitLine(string_view line, string_view &stamp, string_view &entry) {
+    size_t close = line.find(']');
+    if (line.empty() || line[0] != '[' || close == string_view::npos) return false;
+    size_t colon = line.find(": ", close);
+    if (colon == string_view::npos) return false;
+    stamp = line.substr(1, close - 1);
+    entry = line.substr(colon + 2);
+    return true;
+}
+
+} // namespace
+
+const char *exportExtension(ExportFormat format) {
+    return format == ExportFormat::Csv ? "csv" : "bin";
+}
+
+bool exportHistory(TransactionLog &log, int wallet_id, const string &path, ExportFormat format, uint64_t &lines,
+                   LogStamp to) {
+    lines = 0;
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) return false;
+    string buf;
+    buf.reserve(kBufferBytes + 4096);
+    if (format == ExportFormat::Csv) {
+        buf += "timestamp,wallet_id,entry\n";
+    } else {
+        buf.append("WHX1", 4);
+        putLE(buf, static_cast<uint32_t>(wallet_id), 4);
+    }
+    string id = to_string(wallet_id);
+
+    log.forEach(wallet_id, [&](string_view line) {
+        LogStamp ts;
+        int wid;
+        string_view stamp, entry;
+        // Lines that only mention the wallet in their text belong to another one.
+        if (!TransactionLog::parseLine(line, ts, wid) || wid != wallet_id || !splitLine(line, stamp, entry)) return;
+        if (format == ExportFormat::Csv) {
+            buf.append(stamp);
+            buf.push_back(',');
+            buf += id;
+            buf += ",\"";
+            for (char c : entry) {
+                if (c == '"') buf.push_back('"');
+                buf.push_back(c);
+            }
+            buf += "\"\n";
+        } else {
+            putLE(buf, ts, 8);
+            putLE(buf, entry.size(), 4);
+            buf.append(entry);
+        }
+        ++lines;
+        if (buf.size() >= kBufferBytes) {
+            out.write(buf.data(), static_cast<streamsize>(buf.size()));
+            buf.clear();
+        }
+    }, 0, to);
+
+    out.write(buf.data(), static_cast<streamsize>(buf.size()));
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Writes the whole history of one wallet to a file, oldest first.
+//
+// The log is read one segment at a time and the output goes out through a
+// fixed 1 MB buffer, so a wallet with millions of lines is exported with
+// sequential reads and writes and never held in memory at once.
+//
+//   csv:    header "timestamp,wallet_id,entry", then one row per line, the
+//           entry quoted.
+//   binary: "WHX1", the wallet id as int32, then per line the stamp as a
+//           YYYYMMDDhhmmss uint64, the entry length as uint32 and the entry
+//           bytes; all integers little-endian.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "transaction_log.h"
+
+enum class ExportFormat { Csv, Binary };
+
+const char *exportExtension(ExportFormat format);
+
+// Returns false if the output cannot be written. lines receives the number of
+// history lines written.
+bool exportHistory(TransactionLog &log, int wallet_id, const std::string &path, ExportFormat format,
+                   uint64_t &lines, LogStamp to = UINT64_MAX);
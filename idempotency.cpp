@@ -0,0 +1,138 @@
+#include "idempotency.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+
+#include "text_loader.h"
+
+using namespace std;
+
+IdempotencyCache::IdempotencyCache() : IdempotencyCache(Config()) {}
+
+IdempotencyCache::IdempotencyCache(Config config) : cfg(std::move(config)) {}
+
+bool IdempotencyCache::validKey(string_view key) {
+    if (key.empty() || key.size() > 64) return false;
+    for (char c : key)
+        if (c <= ' ' || c > '~') return false;
+    return true;
+}
+
+uint64_t IdempotencyCache::fingerprint(string_view op) {
+    return hash<string_view>()(op);
+}
+
+void IdempotencyCache::evictLocked(time_t now) {
+    while (!order.empty() && (order.front().expires <= now || entries.size() > cfg.capacity)) {
+        auto it = entries.find(order.front().key);
+        if (it != entries.end() && it->second.expires == order.front().expires) entries.erase(it);
+        order.pop_front();
+    }
+}
+
+IdempotencyCache::Seen IdempotencyCache::check(const string &key, uint64_t fingerprint, time_t now) {
+    lock_guard<mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second.expires <= now) return Seen::No;
+    return it->second.fingerprint == fingerprint ? Seen::Same : Seen::Different;
+}
+
+bool IdempotencyCache::contains(const string &key, time_t now) {
+    lock_guard<mutex> guard(lock);
+    auto it = entries.find(key);
+    return it != entries.end() && it->second.expires > now;
+}
+
+IdempotencyRecord IdempotencyCache::remember(const string &key, uint64_t fingerprint, time_t now) {
+    lock_guard<mutex> guard(lock);
+    evictLocked(now);
+    IdempotencyRecord rec{key, fingerprint, now + cfg.ttl};
+    entries[key] = {fingerprint, rec.expires};
+    order.push_back(rec);
+    ++unwritten;
+    evictLocked(now);
+    return rec;
+}
+
+string IdempotencyCache::serialize(const vector<IdempotencyRecord> &records) {
+    string out;
+    for (const auto &r : records) {
+        out += to_string(r.expires);
+        out += ' ';
+        out += to_string(r.fingerprint);
+        out += ' ';
+        out += r.key;
+        out += '\n';
+    }
+    return out;
+}
+
+void IdempotencyCache::recover(string_view lines) {
+    if (lines.empty()) return;
+    lock_guard<mutex> guard(lock);
+    ofstream out(cfg.path, ios::app);
+    out.write(lines.data(), static_cast<streamsize>(lines.size()));
+}
+
+void IdempotencyCache::load(time_t now) {
+    lock_guard<mutex> guard(lock);
+    entries.clear();
+    order.clear();
+    fileLines = 0;
+    unwritten = 0;
+
+    string buf;
+    if (!TextLoader::readFile(cfg.path.c_str(), buf)) return;
+    TextLoader::forEachLine(buf, [&](string_view line) {
+        ++fileLines;
+        TextLoader::Tokenizer t(line);
+        string_view expires, fp, key;
+        IdempotencyRecord rec;
+        if (!t.next(expires) || !t.next(fp) || !t.next(key) ||
+            !TextLoader::parseNumber(expires, rec.expires) || !TextLoader::parseNumber(fp, rec.fingerprint) ||
+            rec.expires <= now)
+            return;
+        rec.key = string(key);
+        auto [it, added] = entries.try_emplace(rec.key, Entry{rec.fingerprint, rec.expires});
+        // A line written again by recover().
+        if (!added && it->second.fingerprint == rec.fingerprint && it->second.expires == rec.expires) return;
+        it->second = {rec.fingerprint, rec.expires};
+        order.push_back(std::move(rec));
+    });
+    evictLocked(now);
+    if (fileLines != order.size()) compactLocked();
+}
+
+void IdempotencyCache::persist(const vector<IdempotencyRecord> &records) {
+    if (records.empty()) return;
+    lock_guard<mutex> guard(lock);
+    {
+        ofstream out(cfg.path, ios::app);
+        out << serialize(records);
+    }
+    fileLines += records.size();
+    unwritten -= min(unwritten, records.size());
+    if (fileLines > 2 * order.size() + 1024) compactLocked();
+}
+
+void IdempotencyCache::compactLocked() {
+    // Keys whose operation is still queued for disk stay out of the file, or
+    // a crash could leave a key for an operation that never got persisted.
+    size_t written = order.size() - min(unwritten, order.size());
+    string temp = cfg.path + ".tmp";
+    {
+        ofstream out(temp, ios::trunc);
+        for (size_t i = 0; i < written; ++i)
+            out << order[i].expires << ' ' << order[i].fingerprint << ' ' << order[i].key << '\n';
+        if (!out) return;
+    }
+    rename(temp.c_str(), cfg.path.c_str());
+    fileLines = written;
+}
+
+size_t IdempotencyCache::size() {
+    lock_guard<mutex> guard(lock);
+    return entries.size();
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+// Idempotency keys for the operations that move points.
+//
+// A client that may retry an operation sends a key with it. The first call
+// under a key is applied and remembered here with a fingerprint of what it
+// did; a repeat within the retention window is answered from memory without
+// touching any wallet. Entries expire after ttl seconds, and the oldest are
+// evicted once capacity keys are held. The cache is kept in idempotency.db,
+// one appended line per key, so a retry that straddles a restart is still
+// caught. The file is compacted to the live entries on load and whenever dead
+// lines outnumber them.
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// One remembered key, as written to idempotency.db.
+struct IdempotencyRecord {
+    std::string key;
+    uint64_t fingerprint;
+    time_t expires;
+};
+
+class IdempotencyCache {
+public:
+    struct Config {
+        std::string path = "idempotency.db";
+        size_t capacity = 100000;
+        time_t ttl = 24 * 60 * 60;
+    };
+
+    enum class Seen {
+        No,         // new key, go ahead
+        Same,       // retry of the remembered operation
+        Different,  // key already used for another operation
+    };
+
+    IdempotencyCache();
+    explicit IdempotencyCache(Config config);
+
+    const Config &config() const { return cfg; }
+
+    // Keys are 1 to 64 printable characters without spaces.
+    static bool validKey(std::string_view key);
+    // Identifies an operation, e.g. fingerprint("transfer 1 2 100").
+    static uint64_t fingerprint(std::string_view op);
+
+    Seen check(const std::string &key, uint64_t fingerprint, time_t now);
+    bool contains(const std::string &key, time_t now);
+    // Remembers a key in memory. The record must be handed to persist() once
+    // the operation it guards is on disk, in the order keys were remembered.
+    IdempotencyRecord remember(const std::string &key, uint64_t fingerprint, time_t now);
+
+    // Replaces the cache with the unexpired entries of idempotency.db.
+    void load(time_t now);
+    void persist(const std::vector<IdempotencyRecord> &records);
+
+    // The records as idempotency.db lines. Callers commit them with the
+    // wallet files they guard (ShardSet::commit's note) before persist(), and
+    // after a crash hand the last committed ones to recover() before load(),
+    // so a key is on disk whenever its operation is. Lines already in the
+    // file are harmless: load() keeps one entry per key.
+    static std::string serialize(const std::vector<IdempotencyRecord> &records);
+    void recover(std::string_view lines);
+
+    size_t size();
+
+private:
+    struct Entry {
+        uint64_t fingerprint;
+        time_t expires;
+    };
+
+    // persist() runs on the I/O thread while operations check keys.
+    std::mutex lock;
+    Config cfg;
+    std::unordered_map<std::string, Entry> entries;
+    std::deque<IdempotencyRecord> order;  // insertion order, which is expiry order
+    size_t fileLines = 0;
+    size_t unwritten = 0;  // newest remembered keys not yet passed to persist()
+
+    void evictLocked(time_t now);
+    void compactLocked();
+};
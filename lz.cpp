@@ -0,0 +1,122 @@
+#include "lz.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace lz {
+
+namespace {
+
+constexpr int kHashBits = 16;
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+// Bytes at the end of the input that are always emitted as literals, so the
+// match finder can read 4 bytes without bounds checks.
+constexpr size_t kTailLiterals = 8;
+
+inline uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+void putLength(string &out, size_t extra) {
+    while (extra >= 255) {
+        out.push_back(static_cast<char>(255));
+        extra -= 255;
+    }
+    out.push_back(static_cast<char>(extra));
+}
+
+void emit(string &out, const char *lit, size_t litLen, size_t offset, size_t matchLen) {
+    size_t code = matchLen ? matchLen - kMinMatch : 0;
+    unsigned char token = static_cast<unsigned char>(((litLen < 15 ? litLen : 15) << 4) | (code < 15 ? code : 15));
+    out.push_back(static_cast<char>(token));
+    if (litLen >= 15) putLength(out, litLen - 15);
+    out.append(lit, litLen);
+    if (!matchLen) return;
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (code >= 15) putLength(out, code - 15);
+}
+
+bool getLength(const unsigned char *&ip, const unsigned char *end, size_t &len) {
+    unsigned char b;
+    do {
+        if (ip == end) return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+} // namespace
+
+string compress(string_view src) {
+    string out;
+    out.reserve(src.size() / 2 + 16);
+    const char *base = src.data();
+    size_t n = src.size();
+    size_t anchor = 0;
+
+    if (n > kTailLiterals + kMinMatch) {
+        vector<int64_t> table(size_t(1) << kHashBits, -1);
+        size_t limit = n - kTailLiterals;
+        size_t i = 0;
+        while (i < limit) {
+            uint32_t seq = read32(base + i);
+            uint32_t h = hash32(seq);
+            int64_t cand = table[h];
+            table[h] = static_cast<int64_t>(i);
+            if (cand < 0 || i - static_cast<size_t>(cand) > kMaxOffset || read32(base + cand) != seq) {
+                ++i;
+                continue;
+            }
+            size_t len = kMinMatch;
+            while (i + len < limit && base[cand + len] == base[i + len]) ++len;
+            emit(out, base + anchor, i - anchor, i - static_cast<size_t>(cand), len);
+            i += len;
+            anchor = i;
+        }
+    }
+    emit(out, base + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+bool decompress(string_view src, size_t rawSize, string &out) {
+    out.clear();
+    out.reserve(rawSize);
+    const unsigned char *ip = reinterpret_cast<const unsigned char *>(src.data());
+    const unsigned char *end = ip + src.size();
+
+    while (ip < end) {
+        unsigned char token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && !getLength(ip, end, lit)) return false;
+        if (static_cast<size_t>(end - ip) < lit || out.size() + lit > rawSize) return false;
+        out.append(reinterpret_cast<const char *>(ip), lit);
+        ip += lit;
+        if (ip == end) break;
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !getLength(ip, end, len)) return false;
+        len += kMinMatch;
+        if (offset == 0 || offset > out.size() || out.size() + len > rawSize) return false;
+        // Byte by byte on purpose: matches may overlap their own output.
+        size_t from = out.size() - offset;
+        for (size_t k = 0; k < len; ++k) out.push_back(out[from + k]);
+    }
+    return out.size() == rawSize;
+}
+
+} // namespace lz
@@ -0,0 +1,153 @@
+#include "metrics.h"
+
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+namespace Metrics {
+
+namespace {
+
+struct ThreadSlot {
+    Histogram ops[OpCount];
+};
+
+// Slots are never freed: a thread that exits keeps its counts, and the number
+// of threads in this program is small and fixed.
+struct Registry {
+    mutex lock;
+    vector<ThreadSlot *> slots;
+};
+
+Registry &registry() {
+    static Registry *r = new Registry();
+    return *r;
+}
+
+ThreadSlot *registerSlot() {
+    ThreadSlot *slot = new ThreadSlot();
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    r.slots.push_back(slot);
+    return slot;
+}
+
+const char *const kOpNames[OpCount] = {
+    "load_users",
+    "load_wallets",
+    "save_users",
+    "save_wallets",
+    "wallet_log",
+    "transfer",
+    "top_up",
+    "approve_top_ups",
+    "otp_generate",
+    "run_schedule",
+    "provision_users",
+};
+
+} // namespace
+
+const char *opName(Op op) { return kOpNames[op]; }
+
+uint64_t bucketUpperBound(int bucket) {
+    if (bucket < kSubBuckets) return static_cast<uint64_t>(bucket);
+    int exp = bucket / kSubBuckets + kSubBucketBits - 1;
+    uint64_t sub = static_cast<uint64_t>(bucket % kSubBuckets);
+    uint64_t width = 1ULL << (exp - kSubBucketBits);
+    uint64_t lower = (1ULL << exp) + sub * width;
+    return lower + (width - 1);
+}
+
+Histogram::Histogram() : count(0), sum(0), max(0) {
+    for (auto &b : buckets) b.store(0, memory_order_relaxed);
+}
+
+uint64_t Summary::percentile(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) return min(bucketUpperBound(i), max_ns);
+    }
+    return max_ns;
+}
+
+Histogram &local(Op op) {
+    thread_local ThreadSlot *slot = registerSlot();
+    return slot->ops[op];
+}
+
+Summary collect(Op op) {
+    Summary s;
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    for (ThreadSlot *slot : r.slots) {
+        const Histogram &h = slot->ops[op];
+        s.count += h.count.load(memory_order_relaxed);
+        s.sum_ns += h.sum.load(memory_order_relaxed);
+        s.max_ns = std::max(s.max_ns, h.max.load(memory_order_relaxed));
+        for (int i = 0; i < kBuckets; ++i) s.buckets[i] += h.buckets[i].load(memory_order_relaxed);
+    }
+    return s;
+}
+
+string report() {
+    ostringstream out;
+    char line[160];
+    snprintf(line, sizeof(line), "%-16s %10s %12s %12s %12s %12s\n",
+             "operation", "count", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+    out << line;
+    for (int i = 0; i < OpCount; ++i) {
+        Summary s = collect(static_cast<Op>(i));
+        if (s.count == 0) continue;
+        snprintf(line, sizeof(line), "%-16s %10llu %12.1f %12.1f %12.1f %12.1f\n",
+                 opName(static_cast<Op>(i)), static_cast<unsigned long long>(s.count),
+                 s.sum_ns / 1e3 / s.count, s.percentile(0.5) / 1e3, s.percentile(0.99) / 1e3, s.max_ns / 1e3);
+        out << line;
+    }
+    return out.str();
+}
+
+string prometheusText() {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    ostringstream out;
+    out << "# HELP wallet_op_duration_seconds Latency of wallet core operations.\n";
+    out << "# TYPE wallet_op_duration_seconds summary\n";
+    for (int i = 0; i < OpCount; ++i) {
+        Summary s = collect(static_cast<Op>(i));
+        const char *name = opName(static_cast<Op>(i));
+        for (double q : quantiles)
+            out << "wallet_op_duration_seconds{op=\"" << name << "\",quantile=\"" << q << "\"} "
+                << s.percentile(q) / 1e9 << '\n';
+        out << "wallet_op_duration_seconds_sum{op=\"" << name << "\"} " << s.sum_ns / 1e9 << '\n';
+        out << "wallet_op_duration_seconds_count{op=\"" << name << "\"} " << s.count << '\n';
+    }
+    out << "# HELP wallet_op_duration_seconds_max Slowest observed call per operation.\n";
+    out << "# TYPE wallet_op_duration_seconds_max gauge\n";
+    for (int i = 0; i < OpCount; ++i) {
+        Summary s = collect(static_cast<Op>(i));
+        out << "wallet_op_duration_seconds_max{op=\"" << opName(static_cast<Op>(i)) << "\"} " << s.max_ns / 1e9 << '\n';
+    }
+    return out.str();
+}
+
+bool writePrometheus(const string &path) {
+    // Write to a temporary file and rename so a scraper never sees half a file.
+    string tmp = path + ".tmp";
+    {
+        ofstream ofs(tmp, ios::trunc);
+        if (!ofs) return false;
+        ofs << prometheusText();
+        if (!ofs) return false;
+    }
+    remove(path.c_str());
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+} // namespace Metrics
@@ -0,0 +1,111 @@
+#pragma once
+
+// Per-operation counters and latency histograms for the Database hot paths.
+//
+// Every thread records into its own slot, so the recording side is a couple
+// of uncontended relaxed stores plus two steady_clock reads. Readers merge
+// all slots on demand, either as a text report or in the Prometheus text
+// exposition format.
+//
+// Histograms are HDR-style log-linear: values below 16 ns get their own
+// bucket, larger values are grouped by power of two and each power is split
+// into 16 linear sub-buckets, which bounds the relative error to ~6%.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace Metrics {
+
+enum Op {
+    LoadUsers,
+    LoadWallets,
+    SaveUsers,
+    SaveWallets,
+    WalletLog,
+    Transfer,
+    TopUp,
+    ApproveTopUps,
+    OtpGenerate,
+    RunSchedule,
+    ProvisionUsers,
+    OpCount
+};
+
+const char *opName(Op op);
+
+constexpr int kSubBucketBits = 4;
+constexpr int kSubBuckets = 1 << kSubBucketBits;
+constexpr int kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+inline int bucketFor(uint64_t ns) {
+    if (ns < kSubBuckets) return static_cast<int>(ns);
+    int exp = 63 - __builtin_clzll(ns);
+    int sub = static_cast<int>((ns >> (exp - kSubBucketBits)) & (kSubBuckets - 1));
+    return (exp - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+// Largest value that falls into the bucket.
+uint64_t bucketUpperBound(int bucket);
+
+// Histogram written by a single thread and read by any.
+struct Histogram {
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    Histogram();
+    void record(uint64_t ns) {
+        bump(buckets[bucketFor(ns)], 1);
+        bump(count, 1);
+        bump(sum, ns);
+        if (ns > max.load(std::memory_order_relaxed)) max.store(ns, std::memory_order_relaxed);
+    }
+
+private:
+    static void bump(std::atomic<uint64_t> &a, uint64_t v) {
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+};
+
+// Merged view of one operation across all threads.
+struct Summary {
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t buckets[kBuckets] = {};
+
+    uint64_t percentile(double q) const;
+};
+
+// This thread's histogram for op; created on first use.
+Histogram &local(Op op);
+
+inline void record(Op op, uint64_t ns) { local(op).record(ns); }
+
+Summary collect(Op op);
+
+// Human-readable table, one line per operation that has been recorded.
+std::string report();
+// Prometheus text exposition format.
+std::string prometheusText();
+bool writePrometheus(const std::string &path);
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Op op) : hist(local(op)), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        hist.record(static_cast<uint64_t>(ns));
+    }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    Histogram &hist;
+    std::chrono::steady_clock::time_point start;
+};
+
+} // namespace Metrics
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+// Spreads the bits of x over the whole word (the SplitMix64 finalizer), for
+// hashing small integers such as wallet ids into bloom filters and sketches.
+inline uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
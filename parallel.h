@@ -0,0 +1,24 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Runs f(i) for i in [0, n), on up to one thread per core when parallel.
+template <class F>
+void parallelFor(size_t n, bool parallel, F &&f) {
+    size_t threads = parallel ? std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency())) : 1;
+    if (threads <= 1) {
+        for (size_t i = 0; i < n; ++i) f(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t)
+        pool.emplace_back([&] {
+            for (size_t i; (i = next++) < n;) f(i);
+        });
+    for (auto &t : pool) t.join();
+}
@@ -0,0 +1,46 @@
+#include "provision.h"
+
+#include <fstream>
+#include <string_view>
+
+#include "text_loader.h"
+
+using namespace std;
+
+bool readProvisionFile(const string &path, vector<NewUser> &users, vector<pair<size_t, string>> &rejected) {
+    string buf;
+    if (!TextLoader::readFile(path.c_str(), buf)) return false;
+    size_t line = 0;
+    TextLoader::forEachLine(buf, [&](string_view text) {
+        ++line;
+        TextLoader::Tokenizer t(text);
+        string_view tok[4];
+        size_t n = 0;
+        while (n < 4 && t.next(tok[n])) ++n;
+        if (n == 0) return;
+        if (n < 2 || n > 3) {
+            rejected.push_back({line, "expected <username> <full_name> [password]"});
+            return;
+        }
+        users.push_back({string(tok[0]), string(tok[1]), n == 3 ? string(tok[2]) : string(), line});
+    });
+    return true;
+}
+
+bool writeCredentials(const string &path, const vector<ProvisionedUser> &created) {
+    string out;
+    out.reserve(created.size() * 32);
+    for (const ProvisionedUser &u : created) {
+        out += u.username;
+        out += ' ';
+        out += to_string(u.wallet_id);
+        out += ' ';
+        // Passwords the admin supplied are known already and stay out of the file.
+        out += u.generated ? u.password : "-";
+        out += '\n';
+    }
+    ofstream f(path, ios::trunc);
+    f.write(out.data(), static_cast<streamsize>(out.size()));
+    f.close();
+    return !f.fail();
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Bulk user provisioning: a file of new members in, a file of credentials
+// out. Database::provisionUsers does the work between the two.
+//
+//   input:        one user per line, "<username> <full_name> [password]";
+//                 without a password one is generated and must be changed at
+//                 first login, as with interactive registration.
+//   credentials:  "<username> <wallet_id> <password>" per created user, for
+//                 handing out the temporary passwords; "-" in place of a
+//                 password that came with the input.
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct NewUser {
+    std::string username;
+    std::string full_name;
+    std::string password;  // empty: generate one
+    size_t line = 0;       // in the input file, for error reports
+};
+
+struct ProvisionedUser {
+    std::string username;
+    int wallet_id = 0;
+    std::string password;
+    bool generated = false;
+};
+
+struct ProvisionResult {
+    std::vector<ProvisionedUser> created;
+    std::vector<std::pair<size_t, std::string>> rejected;  // input line, reason
+    bool saved = false;  // false: the credentials file failed, nothing was created
+};
+
+// Returns false if the file cannot be read. Lines that do not have two or
+// three fields go to rejected.
+bool readProvisionFile(const std::string &path, std::vector<NewUser> &users,
+                       std::vector<std::pair<size_t, std::string>> &rejected);
+bool writeCredentials(const std::string &path, const std::vector<ProvisionedUser> &created);
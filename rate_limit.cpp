@@ -0,0 +1,116 @@
+#include "rate_limit.h"
+
+#include <algorithm>
+
+#include "mix.h"
+#include "text_loader.h"
+
+using namespace std;
+
+VelocitySketch::VelocitySketch(time_t window, size_t width)
+    : window(window), width(width), current(kDepth * width), previous(kDepth * width) {}
+
+size_t VelocitySketch::slot(size_t row, uint64_t key) const {
+    return row * width + mix(key + row * 0x632be59bd9b4e019ULL) % width;
+}
+
+void VelocitySketch::advance(time_t now) {
+    int64_t w = now / window;
+    if (w == currentWindow) return;
+    if (w == currentWindow + 1) {
+        swap(previous, current);
+        fill(current.begin(), current.end(), 0);
+    } else {
+        clear();
+    }
+    currentWindow = w;
+}
+
+void VelocitySketch::clear() {
+    fill(current.begin(), current.end(), 0);
+    fill(previous.begin(), previous.end(), 0);
+}
+
+uint64_t VelocitySketch::estimate(uint64_t key, time_t now) {
+    advance(now);
+    // Share of the previous window still inside [now - window, now].
+    uint64_t overlap = static_cast<uint64_t>(window - now % window);
+    uint64_t best = UINT64_MAX;
+    for (size_t r = 0; r < kDepth; ++r) {
+        size_t s = slot(r, key);
+        uint64_t prev = previous[s];
+        // Rounded up, so the estimate stays an upper bound.
+        uint64_t v = current[s] + (prev * overlap + static_cast<uint64_t>(window) - 1) / static_cast<uint64_t>(window);
+        best = min(best, v);
+    }
+    return best;
+}
+
+void VelocitySketch::add(uint64_t key, uint64_t amount, time_t now) {
+    advance(now);
+    // Conservative update: only the counters at the current minimum grow,
+    // which keeps collisions from inflating the other rows.
+    size_t slots[kDepth];
+    uint64_t low = UINT64_MAX;
+    for (size_t r = 0; r < kDepth; ++r) {
+        slots[r] = slot(r, key);
+        low = min(low, current[slots[r]]);
+    }
+    for (size_t s : slots) current[s] = max(current[s], low + amount);
+}
+
+RateLimiter::RateLimiter() : RateLimiter(Config()) {}
+
+RateLimiter::RateLimiter(Config config) : cfg(config), ops(60), points(24 * 60 * 60) {}
+
+RateLimiter::Config RateLimiter::config() {
+    lock_guard<mutex> guard(lock);
+    return cfg;
+}
+
+void RateLimiter::configure(Config config) {
+    lock_guard<mutex> guard(lock);
+    cfg = config;
+    ops.clear();
+    points.clear();
+}
+
+RateLimiter::Verdict RateLimiter::check(int wallet_id, long long amount, time_t now) {
+    lock_guard<mutex> guard(lock);
+    uint64_t key = static_cast<uint64_t>(wallet_id);
+    if (cfg.opsPerMinute && ops.estimate(key, now) + 1 > cfg.opsPerMinute) return Verdict::TooManyOps;
+    uint64_t pts = amount > 0 ? static_cast<uint64_t>(amount) : 0;
+    if (cfg.pointsPerDay && points.estimate(key, now) + pts > cfg.pointsPerDay) return Verdict::TooManyPoints;
+    return Verdict::Allowed;
+}
+
+void RateLimiter::record(int wallet_id, long long amount, time_t now) {
+    lock_guard<mutex> guard(lock);
+    uint64_t key = static_cast<uint64_t>(wallet_id);
+    if (cfg.opsPerMinute) ops.add(key, 1, now);
+    if (cfg.pointsPerDay && amount > 0) points.add(key, static_cast<uint64_t>(amount), now);
+}
+
+void WalletLimits::load(const char *path) {
+    string buf;
+    if (!TextLoader::readFile(path, buf)) return;
+    TextLoader::forEachLine(buf, [&](string_view line) {
+        TextLoader::Tokenizer t(line);
+        string_view kind, ops, pts;
+        RateLimiter::Config c;
+        if (!t.next(kind) || !t.next(ops) || !t.next(pts) || !TextLoader::parseNumber(ops, c.opsPerMinute) ||
+            !TextLoader::parseNumber(pts, c.pointsPerDay))
+            return;
+        if (kind == "transfer") transfers.configure(c);
+        else if (kind == "topup_request") topUpRequests.configure(c);
+    });
+}
+
+string describe(RateLimiter::Verdict v) {
+    switch (v) {
+    case RateLimiter::Verdict::Allowed: return "Allowed.";
+    case RateLimiter::Verdict::TooManyOps: return "Too many requests from this wallet. Try again in a minute.";
+    case RateLimiter::Verdict::TooManyPoints: return "Daily points limit reached for this wallet.";
+    }
+    return "";
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// Per-wallet velocity limits: operations per minute and points per day.
+//
+// Counts are kept in count-min sketches rather than a map of wallets, so the
+// memory used is fixed no matter how many wallets are active. A sketch can
+// only overestimate, which means a hash collision may hold a wallet back a
+// little early but never lets one through past its limit. Each sketch covers
+// two consecutive windows and weighs the previous one by how much of it still
+// overlaps the sliding window ending now.
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class VelocitySketch {
+public:
+    static constexpr size_t kDepth = 4;
+
+    explicit VelocitySketch(time_t window, size_t width = 1024);
+
+    // Amount added for key over the last window seconds.
+    uint64_t estimate(uint64_t key, time_t now);
+    void add(uint64_t key, uint64_t amount, time_t now);
+    void clear();
+
+private:
+    time_t window;
+    size_t width;
+    int64_t currentWindow = 0;
+    std::vector<uint64_t> current;   // kDepth rows of width counters
+    std::vector<uint64_t> previous;
+
+    void advance(time_t now);
+    size_t slot(size_t row, uint64_t key) const;
+};
+
+class RateLimiter {
+public:
+    // 0 disables a limit.
+    struct Config {
+        uint64_t opsPerMinute = 0;
+        uint64_t pointsPerDay = 0;
+    };
+
+    enum class Verdict { Allowed, TooManyOps, TooManyPoints };
+
+    RateLimiter();
+    explicit RateLimiter(Config config);
+
+    Config config();
+    void configure(Config config);
+
+    // Whether the wallet may do one more operation of amount points now.
+    Verdict check(int wallet_id, long long amount, time_t now);
+    // Counts an operation that went through.
+    void record(int wallet_id, long long amount, time_t now);
+
+private:
+    // Limits are checked from the menus as well as from pipeline workers.
+    std::mutex lock;
+    Config cfg;
+    VelocitySketch ops;
+    VelocitySketch points;
+};
+
+// Limits for the operations users start themselves. Read from limits.db if
+// present, one "<kind> <ops_per_minute> <points_per_day>" line per kind,
+// kind being transfer or topup_request.
+struct WalletLimits {
+    RateLimiter transfers{{30, 1000000}};
+    RateLimiter topUpRequests{{5, 100000}};
+
+    void load(const char *path = "limits.db");
+};
+
+// Message for a refused operation, for the menus.
+std::string describe(RateLimiter::Verdict v);
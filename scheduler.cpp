@@ -0,0 +1,237 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "text_loader.h"
+#include "wallet_core.h"
+
+using namespace std;
+
+namespace {
+
+int daysInMonth(int year, int month) {
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 1 && leap ? 29 : days[month];
+}
+
+} // namespace
+
+time_t StandingOrder::due() const {
+    if (period == Once || fired == 0) return start;
+    tm t = *localtime(&start);
+    long long steps = static_cast<long long>(fired) * every;
+    switch (period) {
+    case Daily: t.tm_mday += static_cast<int>(steps); break;
+    case Weekly: t.tm_mday += static_cast<int>(steps * 7); break;
+    case Monthly: {
+        long long month = t.tm_mon + steps;
+        t.tm_year += static_cast<int>(month / 12);
+        t.tm_mon = static_cast<int>(month % 12);
+        t.tm_mday = min(t.tm_mday, daysInMonth(t.tm_year + 1900, t.tm_mon));
+        break;
+    }
+    case Once: break;
+    }
+    // Same wall-clock time across daylight saving changes.
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+const char *periodName(StandingOrder::Period p) {
+    switch (p) {
+    case StandingOrder::Once: return "once";
+    case StandingOrder::Daily: return "daily";
+    case StandingOrder::Weekly: return "weekly";
+    case StandingOrder::Monthly: return "monthly";
+    }
+    return "once";
+}
+
+bool parsePeriod(string_view name, StandingOrder::Period &p) {
+    for (auto v : {StandingOrder::Once, StandingOrder::Daily, StandingOrder::Weekly, StandingOrder::Monthly}) {
+        if (name == periodName(v)) {
+            p = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TimerWheel::insert(uint64_t id, uint64_t due) {
+    place({id, due});
+    ++count;
+}
+
+void TimerWheel::place(const Entry &e) {
+    if (e.due <= current) {
+        ready.push_back(e);
+        return;
+    }
+    // The lowest level whose span covers the distance; anything further out
+    // than the top level spans waits there and is placed again on cascade.
+    uint64_t delta = e.due - current;
+    unsigned level = 0;
+    while (level + 1 < kLevels && (delta >> (kSlotBits * (level + 1))) != 0) ++level;
+    slots[level][(e.due >> (kSlotBits * level)) & (kSlots - 1)].push_back(e);
+}
+
+void TimerWheel::cascade(unsigned level) {
+    auto &slot = slots[level][(current >> (kSlotBits * level)) & (kSlots - 1)];
+    vector<Entry> moving;
+    moving.swap(slot);
+    for (const Entry &e : moving) place(e);
+}
+
+void TimerWheel::advance(uint64_t now, vector<uint64_t> &out) {
+    // Nothing waiting: no need to walk the ticks in between.
+    if (count == 0) current = max(current, now);
+    while (current < now) {
+        ++current;
+        for (unsigned level = kLevels - 1; level > 0; --level)
+            if ((current & ((uint64_t(1) << (kSlotBits * level)) - 1)) == 0) cascade(level);
+        auto &slot = slots[0][current & (kSlots - 1)];
+        ready.insert(ready.end(), slot.begin(), slot.end());
+        slot.clear();
+    }
+    for (const Entry &e : ready) out.push_back(e.id);
+    count -= ready.size();
+    ready.clear();
+}
+
+Scheduler::Scheduler(string path, time_t now) : file(std::move(path)), wheel(static_cast<uint64_t>(now)) {}
+
+void Scheduler::schedule(const StandingOrder &o) {
+    wheel.insert(o.id, static_cast<uint64_t>(max<time_t>(o.due(), 0)));
+}
+
+bool Scheduler::load() {
+    lock_guard<mutex> guard(lock);
+    jobs.clear();
+    wheel = TimerWheel(wheel.now());
+    string buf;
+    if (!TextLoader::readFile(file.c_str(), buf)) return false;
+    TextLoader::forEachLine(buf, [&](string_view line) {
+        // <id> <from> <to> <amount> <period> <every> <start> <fired>
+        TextLoader::Tokenizer t(line);
+        string_view tok[8];
+        for (auto &x : tok)
+            if (!t.next(x)) return;
+        StandingOrder o;
+        if (!TextLoader::parseNumber(tok[0], o.id) || !TextLoader::parseNumber(tok[1], o.from) ||
+            !TextLoader::parseNumber(tok[2], o.to) || !TextLoader::parseNumber(tok[3], o.amount) ||
+            !parsePeriod(tok[4], o.period) || !TextLoader::parseNumber(tok[5], o.every) ||
+            !TextLoader::parseNumber(tok[6], o.start) || !TextLoader::parseNumber(tok[7], o.fired))
+            return;
+        nextId = max(nextId, o.id + 1);
+        jobs[o.id] = o;
+        schedule(o);
+    });
+    return true;
+}
+
+string Scheduler::serialize() {
+    lock_guard<mutex> guard(lock);
+    vector<const StandingOrder *> sorted;
+    sorted.reserve(jobs.size());
+    for (auto &p : jobs) sorted.push_back(&p.second);
+    sort(sorted.begin(), sorted.end(), [](auto *a, auto *b) { return a->id < b->id; });
+    string out;
+    for (const StandingOrder *o : sorted) {
+        out += to_string(o->id) + " " + to_string(o->from) + " " + to_string(o->to) + " " + to_string(o->amount) +
+               " " + periodName(o->period) + " " + to_string(o->every) + " " + to_string(o->start) + " " +
+               to_string(o->fired) + "\n";
+    }
+    return out;
+}
+
+bool Scheduler::writeFile(const string &path, const string &content) {
+    string temp = path + ".tmp";
+    {
+        ofstream out(temp, ios::trunc);
+        out.write(content.data(), static_cast<streamsize>(content.size()));
+        if (!out) return false;
+    }
+    return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+bool Scheduler::save() {
+    return writeFile(file, serialize());
+}
+
+uint64_t Scheduler::add(StandingOrder order) {
+    lock_guard<mutex> guard(lock);
+    if (order.every == 0) order.every = 1;
+    order.id = nextId++;
+    order.fired = 0;
+    jobs[order.id] = order;
+    schedule(order);
+    return order.id;
+}
+
+bool Scheduler::cancel(uint64_t id) {
+    lock_guard<mutex> guard(lock);
+    // The wheel entry stays behind and is dropped when it comes up.
+    return jobs.erase(id) > 0;
+}
+
+vector<StandingOrder> Scheduler::orders() {
+    lock_guard<mutex> guard(lock);
+    vector<StandingOrder> out;
+    out.reserve(jobs.size());
+    for (auto &p : jobs) out.push_back(p.second);
+    sort(out.begin(), out.end(), [](const auto &a, const auto &b) { return a.id < b.id; });
+    return out;
+}
+
+ScheduleRun Scheduler::runDue(time_t now, Database &db, vector<LogEntry> &log) {
+    Metrics::ScopedTimer timer(Metrics::RunSchedule);
+    lock_guard<mutex> guard(lock);
+    vector<uint64_t> due;
+    wheel.advance(static_cast<uint64_t>(max<time_t>(now, 0)), due);
+    // Oldest order first, so a shortfall hits the newest ones.
+    sort(due.begin(), due.end());
+
+    ScheduleRun run;
+    vector<int> members;
+    bool haveMembers = false;
+    for (uint64_t id : due) {
+        auto it = jobs.find(id);
+        if (it == jobs.end()) continue;
+        StandingOrder &o = it->second;
+        if (o.due() > now) {
+            schedule(o);
+            continue;
+        }
+
+        ++run.orders;
+        auto pay = [&](int to) {
+            if (db.applyStandingOrder(o.from, to, o.amount, log)) ++run.transfers;
+            else ++run.failed;
+        };
+        if (o.to == StandingOrder::kAllMembers) {
+            if (!haveMembers) {
+                db.snapshot().forEachUser([&](const UserRow &u) {
+                    if (!u.is_admin) members.push_back(u.wallet_id);
+                });
+                haveMembers = true;
+            }
+            for (int w : members)
+                if (w != o.from) pay(w);
+        } else {
+            pay(o.to);
+        }
+
+        if (o.period == StandingOrder::Once) {
+            jobs.erase(it);
+            continue;
+        }
+        do {
+            ++o.fired;
+        } while (o.due() <= now);
+        schedule(o);
+    }
+    return run;
+}
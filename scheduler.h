@@ -0,0 +1,117 @@
+#pragma once
+
+// Standing orders: transfers that run once at a set time or repeat daily,
+// weekly or monthly, such as a monthly allowance from the central wallet to
+// every member.
+//
+// Orders are kept in schedules.db and their next run times in a hierarchical
+// timer wheel: four levels of 256 one-second slots, so adding an order and
+// finding the ones due are O(1), with an order moving down a level at most
+// three times before it fires. Everything that comes due in one pass is
+// applied in memory and handed back as one batch of log lines, so the caller
+// writes the log, wallets.db and schedules.db once per pass however many
+// payouts it made.
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "env.h"
+#include "transaction_log.h"
+
+class Database;
+
+struct StandingOrder {
+    enum Period { Once, Daily, Weekly, Monthly };
+    // Target meaning every wallet that belongs to a non-admin user.
+    static constexpr int kAllMembers = -1;
+
+    uint64_t id = 0;
+    int from = 0;
+    int to = 0;
+    long long amount = 0;
+    Period period = Once;
+    unsigned every = 1;   // in periods
+    time_t start = 0;     // first run
+    uint64_t fired = 0;   // runs done or skipped
+
+    // Time of run number fired. Monthly orders keep the day of the month of
+    // start, moved back to the last day in shorter months.
+    time_t due() const;
+};
+
+const char *periodName(StandingOrder::Period p);
+bool parsePeriod(std::string_view name, StandingOrder::Period &p);
+
+class TimerWheel {
+public:
+    static constexpr unsigned kLevels = 4;
+    static constexpr unsigned kSlotBits = 8;
+    static constexpr unsigned kSlots = 1u << kSlotBits;
+
+    explicit TimerWheel(uint64_t now = 0) : current(now) {}
+
+    uint64_t now() const { return current; }
+    size_t size() const { return count; }
+
+    void insert(uint64_t id, uint64_t due);
+    // Moves the wheel to now and appends every id due by then to out.
+    void advance(uint64_t now, std::vector<uint64_t> &out);
+
+private:
+    struct Entry {
+        uint64_t id;
+        uint64_t due;
+    };
+
+    uint64_t current;
+    size_t count = 0;
+    std::vector<Entry> slots[kLevels][kSlots];
+    std::vector<Entry> ready;  // due at or before current
+
+    void place(const Entry &e);
+    void cascade(unsigned level);
+};
+
+// What one pass of the scheduler did.
+struct ScheduleRun {
+    size_t orders = 0;     // orders that fired
+    size_t transfers = 0;  // payouts made
+    size_t failed = 0;     // payouts refused: missing wallet or funds
+};
+
+class Scheduler {
+public:
+    explicit Scheduler(std::string path = "schedules.db", time_t now = Env::now());
+
+    // Replaces the orders with the ones in schedules.db. An order whose run
+    // was missed while nothing was running fires once on the next pass and
+    // then goes on from its next run after now.
+    bool load();
+    std::string serialize();
+    bool save();
+    static bool writeFile(const std::string &path, const std::string &content);
+    const std::string &path() const { return file; }
+
+    // Returns the id given to the order.
+    uint64_t add(StandingOrder order);
+    bool cancel(uint64_t id);
+    std::vector<StandingOrder> orders();
+
+    // Runs every order due by now against db and appends the log lines of
+    // the payouts to log. Writes nothing; the caller must hold whatever
+    // guards db and then persist log, wallets.db and serialize().
+    ScheduleRun runDue(time_t now, Database &db, std::vector<LogEntry> &log);
+
+private:
+    std::mutex lock;
+    std::string file;
+    uint64_t nextId = 1;
+    std::unordered_map<uint64_t, StandingOrder> jobs;
+    TimerWheel wheel;
+
+    void schedule(const StandingOrder &o);
+};
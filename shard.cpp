@@ -0,0 +1,276 @@
+#include "shard.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+#include "parallel.h"
+#include "text_loader.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// Below this many bytes a thread per shard costs more than it saves.
+constexpr uintmax_t kParallelBytes = 1 << 20;
+
+bool writeAll(const string &path, const string &content) {
+    ofstream out(path, ios::trunc);
+    out.write(content.data(), static_cast<streamsize>(content.size()));
+    return static_cast<bool>(out);
+}
+
+bool writeAtomically(const string &path, const string &content) {
+    string temp = path + ".tmp";
+    return writeAll(temp, content) && rename(temp.c_str(), path.c_str()) == 0;
+}
+
+// Shard number of "users.<k>.db<suffix>" or "wallets.<k>.db<suffix>".
+bool shardOfName(string_view name, string_view suffix, unsigned &k) {
+    if (name.size() < suffix.size() || name.substr(name.size() - suffix.size()) != suffix) return false;
+    name.remove_suffix(suffix.size());
+    if (name.size() < 3 || name.substr(name.size() - 3) != ".db") return false;
+    name.remove_suffix(3);
+    size_t dot = name.find('.');
+    if (dot == string_view::npos) return false;
+    string_view table = name.substr(0, dot);
+    if (table != "users" && table != "wallets") return false;
+    return TextLoader::parseNumber(name.substr(dot + 1), k);
+}
+
+} // namespace
+
+void ShardSet::open(const char *config) {
+    unique_lock<shared_mutex> guard(commitLock);
+    string buf;
+    layout = 1;
+    committed = 0;
+    lastNote.clear();
+    // commit.db: "<shard count> <last committed transaction>", then its note
+    if (TextLoader::readFile(decisionPath().c_str(), buf)) {
+        size_t nl = buf.find('\n');
+        TextLoader::Tokenizer t(string_view(buf).substr(0, nl));
+        string_view n, tx;
+        unsigned count;
+        if (t.next(n) && t.next(tx) && TextLoader::parseNumber(n, count) && count > 0 &&
+            TextLoader::parseNumber(tx, committed)) {
+            layout = count;
+            if (nl != string::npos) lastNote = buf.substr(nl + 1);
+        }
+    }
+    target = layout;
+    if (TextLoader::readFile(config, buf)) {
+        TextLoader::Tokenizer t(buf);
+        string_view n;
+        unsigned count;
+        if (t.next(n) && TextLoader::parseNumber(n, count) && count > 0) target = count;
+    }
+    shards.clear();
+    for (unsigned k = 0; k < max(layout, target); ++k) shards.push_back(make_unique<Shard>());
+    recover();
+}
+
+string ShardSet::path(Table t, unsigned shard, unsigned of) const {
+    string name = t == Users ? "users" : "wallets";
+    if (of <= 1) return name + ".db";
+    return (fs::path(root) / (name + "." + to_string(shard) + ".db")).string();
+}
+
+string ShardSet::pathOf(const File &f, unsigned of) const {
+    return f.path.empty() ? path(f.table, f.shard, of) : f.path;
+}
+
+string ShardSet::journalPath(unsigned shard) const {
+    return (fs::path(root) / ("journal." + to_string(shard) + ".db")).string();
+}
+
+string ShardSet::decisionPath() const {
+    return (fs::path(root) / "commit.db").string();
+}
+
+ShardSet::Stamp ShardSet::stampOf(const string &path) {
+    Stamp s;
+    error_code ec;
+    uintmax_t size = fs::file_size(path, ec);
+    if (ec) return s;
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec) return s;
+    s.present = true;
+    s.size = size;
+    s.mtime = mtime;
+    s.racy = fs::file_time_type::clock::now() - mtime < chrono::seconds(kRacySeconds);
+    return s;
+}
+
+void ShardSet::recover() {
+    // A new file survives only if its shard journalled a transaction that
+    // commit.db records; the rest belong to a commit that never happened.
+    vector<pair<string, unsigned>> pending;
+    vector<string> journals;
+    error_code ec;
+    for (Table t : {Users, Wallets}) {
+        string p = path(t, 0, 1) + ".pending";
+        if (fs::exists(p, ec)) pending.push_back({p, 0});
+    }
+    for (fs::directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        string name = it->path().filename().string();
+        unsigned k;
+        if (shardOfName(name, ".pending", k)) pending.push_back({it->path().string(), k});
+        else if (name.rfind("journal.", 0) == 0) journals.push_back(it->path().string());
+    }
+    string buf;
+    auto decided = [&](const string &journal) {
+        uint64_t tx = 0;
+        buf.clear();
+        return TextLoader::readFile(journal.c_str(), buf) &&
+               TextLoader::parseNumber(string_view(buf).substr(0, buf.find('\n')), tx) && tx != 0 && tx <= committed;
+    };
+    for (const auto &[p, k] : pending) {
+        if (decided(journalPath(k))) rename(p.c_str(), p.substr(0, p.size() - 8).c_str());
+        else remove(p.c_str());
+    }
+    // A journal lists the files outside the tables after its transaction id.
+    for (const string &j : journals) {
+        bool done = decided(j);
+        size_t nl = buf.find('\n');
+        if (nl != string::npos) {
+            TextLoader::forEachLine(string_view(buf).substr(nl + 1), [&](string_view line) {
+                if (line.empty()) return;
+                string p(line);
+                if (done) rename((p + ".pending").c_str(), p.c_str());
+                else remove((p + ".pending").c_str());
+            });
+        }
+        remove(j.c_str());
+    }
+}
+
+bool ShardSet::writeDecision(unsigned count, uint64_t tx, const string &note) {
+    return writeAtomically(decisionPath(), to_string(count) + " " + to_string(tx) + "\n" + note);
+}
+
+void ShardSet::read(Table t, bool force, const function<void(unsigned, string_view)> &f) {
+    // Keeps a multi-file commit from changing the layout halfway through.
+    shared_lock<shared_mutex> shared(commitLock);
+    vector<pair<unsigned, Stamp>> changed;
+    uintmax_t bytes = 0;
+    for (unsigned k = 0; k < layout; ++k) {
+        Stamp now = stampOf(path(t, k, layout));
+        lock_guard<mutex> guard(shards[k]->lock);
+        const Stamp &seen = shards[k]->seen[t];
+        if (!now.present || (!force && seen == now && !seen.racy)) continue;
+        changed.push_back({k, now});
+        bytes += now.size;
+    }
+    parallelFor(changed.size(), bytes >= kParallelBytes, [&](size_t i) {
+        auto [k, stamp] = changed[i];
+        Shard &s = *shards[k];
+        lock_guard<mutex> guard(s.lock);
+        if (!TextLoader::readFile(path(t, k, layout).c_str(), s.buf)) return;
+        // Stamped before reading: a change made meanwhile is read next time.
+        s.seen[t] = stamp;
+        f(k, s.buf);
+    });
+}
+
+bool ShardSet::commit(vector<File> files, const string &note) {
+    if (files.empty() && note.empty()) return true;
+    error_code ec;
+    if (files.size() == 1 && note.empty() && files[0].path.empty()) {
+        shared_lock<shared_mutex> shared(commitLock);
+        if (layout == target) {
+            // A single file needs no journal: one rename replaces it whole,
+            // under its shard's lock alone.
+            const File &f = files[0];
+            if (target > 1) fs::create_directories(root, ec);
+            Shard &s = *shards[f.shard];
+            lock_guard<mutex> shardGuard(s.lock);
+            string p = path(f.table, f.shard, target);
+            if (!writeAll(p + ".pending", f.content) || rename((p + ".pending").c_str(), p.c_str()) != 0)
+                return false;
+            s.seen[f.table] = stampOf(p);
+            return true;
+        }
+    }
+
+    unique_lock<shared_mutex> guard(commitLock);
+    // A commit without table files cannot finish a reshard, which needs
+    // every shard's.
+    bool tables = any_of(files.begin(), files.end(), [](const File &f) { return f.path.empty(); });
+    unsigned next = tables ? target : layout;
+    bool reshard = layout != next;
+    fs::create_directories(root, ec);
+
+    // Each shard writes its own files, under its own lock.
+    sort(files.begin(), files.end(), [](const File &a, const File &b) { return a.shard < b.shard; });
+    vector<pair<size_t, size_t>> groups;
+    uintmax_t bytes = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (groups.empty() || files[groups.back().first].shard != files[i].shard) groups.push_back({i, i});
+        ++groups.back().second;
+        bytes += files[i].content.size();
+    }
+    bool parallel = bytes >= kParallelBytes;
+    uint64_t tx = committed + 1;
+
+    // Phase 1: every shard writes its new files beside the old ones, then
+    // journals the transaction.
+    vector<char> prepared(groups.size(), 0);
+    parallelFor(groups.size(), parallel, [&](size_t g) {
+        auto [b, e] = groups[g];
+        unsigned k = files[b].shard;
+        lock_guard<mutex> shardGuard(shards[k]->lock);
+        string journal = to_string(tx) + "\n";
+        for (size_t i = b; i < e; ++i) {
+            if (!writeAll(pathOf(files[i], next) + ".pending", files[i].content)) return;
+            if (!files[i].path.empty()) journal += files[i].path + "\n";
+        }
+        prepared[g] = writeAll(journalPath(k), journal);
+    });
+
+    // The decision: from here on the transaction counts as committed.
+    if (std::count(prepared.begin(), prepared.end(), 0) != 0 || !writeDecision(next, tx, note)) {
+        for (const File &f : files) remove((pathOf(f, next) + ".pending").c_str());
+        for (auto [b, e] : groups) remove(journalPath(files[b].shard).c_str());
+        return false;
+    }
+    unsigned old = layout;
+    committed = tx;
+    lastNote = note;
+    layout = next;
+
+    // Phase 2: every shard moves its files into place and clears its journal.
+    parallelFor(groups.size(), parallel, [&](size_t g) {
+        auto [b, e] = groups[g];
+        unsigned k = files[b].shard;
+        Shard &s = *shards[k];
+        lock_guard<mutex> shardGuard(s.lock);
+        for (size_t i = b; i < e; ++i) {
+            string p = pathOf(files[i], next);
+            rename((p + ".pending").c_str(), p.c_str());
+            if (files[i].path.empty()) s.seen[files[i].table] = stampOf(p);
+        }
+        remove(journalPath(k).c_str());
+    });
+
+    if (reshard) {
+        for (Table t : {Users, Wallets})
+            for (unsigned k = 0; k < old; ++k) {
+                string p = path(t, k, old);
+                if (k >= target || p != path(t, k, target)) remove(p.c_str());
+            }
+    }
+    return true;
+}
+
+void ShardSet::backup() {
+    unique_lock<shared_mutex> guard(commitLock);
+    auto moveAside = [](const string &p) {
+        rename(p.c_str(), (p.substr(0, p.size() - 3) + "_backup.db").c_str());
+    };
+    for (Table t : {Users, Wallets})
+        for (unsigned k = 0; k < layout; ++k) moveAside(path(t, k, layout));
+    moveAside(decisionPath());
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+// The wallet and user tables split into shard files by wallet id.
+//
+// With one shard, the default, the tables stay in users.db and wallets.db.
+// With a count N > 1 in shards.db they move to shards/users.<k>.db and
+// shards/wallets.<k>.db, where wallet w and the user who owns it belong to
+// shard w % N. A save then rewrites only the shards that changed, and a load
+// reads only the shards that changed on disk, on one thread per shard when
+// there is enough to read.
+//
+// A save that spans several files commits in two phases. Each shard writes
+// its new files next to the old ones and then its transaction id to its own
+// journal (prepare); shards/commit.db then records the id (the decision);
+// then each shard moves its files into place and clears its journal. If a
+// crash comes before the decision, open() drops the new files; if it comes
+// after, open() moves them into place. Either way no shard is left ahead of
+// the others, so the two sides of a transfer are saved together.
+//
+// A commit may also carry files outside the tables, such as schedules.db, that
+// must be saved together with them. Such a file is written the same way; the
+// journal of its shard lists its path, so open() knows to move it into place.
+//
+// Each shard has a lock, held while its files are read or written. A commit
+// of a single shard file takes only that lock, so such commits to different
+// shards can run side by side; commits of several files, which need the
+// shared transaction id, run one at a time.
+//
+// A file whose size and modification time match what was last read is not
+// read again, unless that time was within kRacySeconds of the reading: a
+// rewrite by another process in the same timestamp tick could keep both.
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ShardSet {
+public:
+    enum Table { Users, Wallets };
+
+    // One file of a commit. A file outside the tables names its path; table
+    // is then ignored and shard only picks the journal that lists it.
+    struct File {
+        Table table;
+        unsigned shard;
+        std::string content;
+        std::string path = "";
+    };
+
+    explicit ShardSet(std::string dir = "shards") : root(std::move(dir)) {}
+
+    // Reads the configured count (one number; without the file the count on
+    // disk is kept) and the layout on disk, then finishes or drops a commit
+    // that a crash interrupted.
+    void open(const char *config = "shards.db");
+
+    unsigned count() const { return target; }
+    // Shards the files on disk are split into. Differs from count() after the
+    // configured count changed, until the next commit of every shard.
+    unsigned stored() const { return layout; }
+    bool resharding() const { return layout != target; }
+    unsigned shardOf(int wallet_id) const { return static_cast<unsigned>(wallet_id) % target; }
+    std::string path(Table t, unsigned shard, unsigned of) const;
+
+    // Calls f(shard, contents) for every file of t on disk that changed since
+    // this set last read or wrote it, or for all of them with force. Large
+    // reads run one thread per shard, and f with them. Multi-file commits
+    // wait until the read is done, so it sees one layout; f must not commit.
+    void read(Table t, bool force, const std::function<void(unsigned, std::string_view)> &f);
+
+    // Writes the files as one transaction. While resharding, files must hold
+    // every shard of both tables, or none; the old layout is removed once
+    // they commit.
+    // A non-empty note is recorded in commit.db with the decision, so it is
+    // durable exactly when the files are: the caller's redo record for work
+    // that belongs to the same transaction but lives elsewhere.
+    bool commit(std::vector<File> files, const std::string &note = "");
+    // The note of the last transaction recorded in commit.db.
+    const std::string &note() const { return lastNote; }
+
+    // Renames the files of the current layout, and commit.db, to *_backup.db.
+    void backup();
+
+private:
+    static constexpr int kRacySeconds = 2;
+
+    struct Stamp {
+        std::filesystem::file_time_type mtime;
+        uintmax_t size = 0;
+        bool present = false;
+        bool racy = false;  // taken too soon after mtime to rule out a same-tick rewrite
+        bool operator==(const Stamp &o) const {
+            return present == o.present && (!present || (mtime == o.mtime && size == o.size));
+        }
+    };
+    struct Shard {
+        std::mutex lock;  // held while its files or journal are read or written
+        std::string buf;  // reused read buffer
+        Stamp seen[2];    // each table file as last read or written, by Table
+    };
+
+    std::string root;
+    unsigned target = 1;
+    unsigned layout = 1;
+    uint64_t committed = 0;  // last transaction id in commit.db
+    std::string lastNote;
+    std::shared_mutex commitLock;  // shared by reads and single-file commits, exclusive otherwise
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::string journalPath(unsigned shard) const;
+    std::string decisionPath() const;
+    std::string pathOf(const File &f, unsigned of) const;
+    static Stamp stampOf(const std::string &path);
+    void recover();
+    bool writeDecision(unsigned count, uint64_t tx, const std::string &note);
+};
@@ -0,0 +1,155 @@
+#include "snapshot.h"
+
+#include <ctime>
+#include <functional>
+#include <queue>
+
+#include "env.h"
+
+using namespace std;
+
+bool Snapshot::balance(int wallet_id, long long &out) const {
+    if (!tables || wallet_id < 0) return false;
+    size_t c = static_cast<size_t>(wallet_id) / detail::WalletChunk::kRows;
+    size_t i = static_cast<size_t>(wallet_id) % detail::WalletChunk::kRows;
+    const auto &chunks = tables->walletChunks;
+    if (c >= chunks.size() || !chunks[c] || !chunks[c]->present[i]) return false;
+    out = chunks[c]->balance[i];
+    return true;
+}
+
+vector<pair<int, long long>> Snapshot::topBalances(size_t n) const {
+    vector<pair<int, long long>> out;
+    if (!tables) return out;
+    const detail::TopBalances &top = tables->top;
+    for (size_t i = 0; i < min(n, top.exact()); ++i) out.push_back({top.rows[i].second, top.rows[i].first});
+    return out;
+}
+
+namespace detail {
+
+namespace {
+
+// Larger balances first, then lower ids.
+bool ranksAbove(const pair<long long, int> &a, const pair<long long, int> &b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+} // namespace
+
+void TopBalances::update(int wallet_id, long long balance) {
+    auto it = find_if(rows.begin(), rows.end(), [&](const pair<long long, int> &r) { return r.second == wallet_id; });
+    if (it != rows.end()) {
+        // A row that drops below outside stays; it just no longer counts as exact.
+        rows.erase(it);
+    } else if (rows.size() >= kKept) {
+        if (balance <= rows.back().first) {
+            outside = max(outside, balance);
+            return;
+        }
+        outside = max(outside, rows.back().first);
+        rows.pop_back();
+    }
+    pair<long long, int> row{balance, wallet_id};
+    rows.insert(lower_bound(rows.begin(), rows.end(), row, ranksAbove), row);
+}
+
+size_t TopBalances::exact() const {
+    return partition_point(rows.begin(), rows.end(), [&](const pair<long long, int> &r) { return r.first >= outside; }) -
+           rows.begin();
+}
+
+} // namespace detail
+
+template <class T>
+T &SnapshotStore::writable(shared_ptr<T> &p) {
+    // Called under lock, where snapshot() cannot take a new reference, so a
+    // count of one means no snapshot can be reading it.
+    if (!p) p = make_shared<T>();
+    else if (p.use_count() > 1) p = make_shared<T>(*p);
+    return *p;
+}
+
+Snapshot SnapshotStore::snapshot() {
+    Snapshot s;
+    s.stamp = TransactionLog::stampOf(Env::now());
+    lock_guard<recursive_mutex> guard(lock);
+    s.seq = ++epoch;
+    s.tables = tables;
+    return s;
+}
+
+void SnapshotStore::setBalance(int wallet_id, long long balance) {
+    if (wallet_id < 0) return;
+    size_t c = static_cast<size_t>(wallet_id) / detail::WalletChunk::kRows;
+    size_t i = static_cast<size_t>(wallet_id) % detail::WalletChunk::kRows;
+    lock_guard<recursive_mutex> guard(lock);
+    detail::Tables &t = writable(tables);
+    if (c >= t.walletChunks.size()) t.walletChunks.resize(c + 1);
+    detail::WalletChunk &chunk = writable(t.walletChunks[c]);
+    long long old = chunk.present[i] ? chunk.balance[i] : 0;
+    if (wallet_id == 0) {
+        t.totals.central = balance;
+    } else {
+        t.totals.userPoints += balance - old;
+        t.totals.userWallets += !chunk.present[i];
+        t.totals.activeWallets += (balance > 0) - (old > 0);
+        t.top.update(wallet_id, balance);
+    }
+    if (!chunk.present[i]) {
+        chunk.present[i] = true;
+        ++t.wallets;
+    }
+    chunk.balance[i] = balance;
+    if (t.top.stale()) rescanTop(t);
+}
+
+void SnapshotStore::rescanTop(detail::Tables &t) {
+    using Row = pair<long long, int>;
+    // Min-heap of the kKept + 1 largest: the extra one bounds everything else.
+    auto below = [](const Row &a, const Row &b) { return detail::ranksAbove(a, b); };
+    priority_queue<Row, vector<Row>, decltype(below)> heap(below);
+    for (size_t c = 0; c < t.walletChunks.size(); ++c) {
+        const detail::WalletChunk *chunk = t.walletChunks[c].get();
+        if (!chunk) continue;
+        for (size_t i = 0; i < detail::WalletChunk::kRows; ++i) {
+            int id = static_cast<int>(c * detail::WalletChunk::kRows + i);
+            if (!chunk->present[i] || id == 0) continue;
+            heap.push({chunk->balance[i], id});
+            if (heap.size() > detail::TopBalances::kKept + 1) heap.pop();
+        }
+    }
+    detail::TopBalances &top = t.top;
+    top.outside = LLONG_MIN;
+    if (heap.size() > detail::TopBalances::kKept) {
+        top.outside = heap.top().first;
+        heap.pop();
+    }
+    top.rows.clear();
+    for (; !heap.empty(); heap.pop()) top.rows.push_back(heap.top());
+    reverse(top.rows.begin(), top.rows.end());
+}
+
+void SnapshotStore::addPendingTopUp(long long amount) {
+    lock_guard<recursive_mutex> guard(lock);
+    detail::Tables &t = writable(tables);
+    ++t.totals.pendingRequests;
+    t.totals.pendingPoints += amount;
+}
+
+void SnapshotStore::setPendingTopUps(size_t requests, long long points) {
+    lock_guard<recursive_mutex> guard(lock);
+    detail::Tables &t = writable(tables);
+    t.totals.pendingRequests = requests;
+    t.totals.pendingPoints = points;
+}
+
+void SnapshotStore::setUser(const UserRow &row) {
+    lock_guard<recursive_mutex> guard(lock);
+    detail::Tables &t = writable(tables);
+    auto it = userSlots.emplace(row.username, userSlots.size()).first;
+    size_t c = it->second / detail::UserChunk::kRows;
+    if (c >= t.userChunks.size()) t.userChunks.resize(c + 1);
+    writable(t.userChunks[c]).rows[it->second % detail::UserChunk::kRows] = row;
+    t.users = userSlots.size();
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+// Point-in-time views of the wallet and user tables for reporting.
+//
+// Database mirrors every balance and user change into a SnapshotStore: the
+// rows sit in fixed-size chunks, listed by a table of chunk pointers, all
+// held by shared_ptr. Taking a snapshot takes one more reference to the
+// table, so it costs the same at any size and never waits for more than one
+// operation. A writer that finds the table or a chunk shared with a live
+// snapshot copies it before changing it, so the first write after a snapshot
+// copies the pointer table and each chunk it touches; the snapshot keeps the
+// old rows. Reports can then scan a snapshot on any thread while transfers go
+// on.
+
+#include <algorithm>
+#include <bitset>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "transaction_log.h"
+
+// The reporting columns of a user. The strings point into Database::strings,
+// so a snapshot must not outlive its Database.
+struct UserRow {
+    std::string_view username;
+    std::string_view full_name;
+    bool is_admin = false;
+    int wallet_id = 0;
+};
+
+// Running totals over the wallet table and topup_requests.db, updated with
+// every balance change and top-up request, so the admin dashboard never scans
+// wallets or request files.
+struct BalanceTotals {
+    long long central = 0;       // wallet 0
+    long long userPoints = 0;    // every other wallet
+    size_t userWallets = 0;
+    size_t activeWallets = 0;    // user wallets holding points
+    size_t pendingRequests = 0;  // in topup_requests.db
+    long long pendingPoints = 0;
+};
+
+namespace detail {
+
+struct WalletChunk {
+    static constexpr size_t kRows = 512;
+    long long balance[kRows] = {};
+    std::bitset<kRows> present;
+};
+
+struct UserChunk {
+    static constexpr size_t kRows = 256;
+    UserRow rows[kRows];
+};
+
+// The largest user balances, without a sorted index of every wallet. rows
+// holds up to kKept wallets, largest first, and no wallet outside rows has
+// more than outside; so the rows down to outside are the true top ranks.
+// Wallets pushed out of rows raise outside, and when fewer than kExact rows
+// are left above it the store rescans the balances.
+struct TopBalances {
+    static constexpr size_t kKept = 64;
+    static constexpr size_t kExact = 16;
+
+    std::vector<std::pair<long long, int>> rows;  // (balance, wallet id)
+    long long outside = LLONG_MIN;
+
+    void update(int wallet_id, long long balance);
+    size_t exact() const;
+    bool stale() const { return exact() < std::min(kExact, rows.size()); }
+};
+
+struct Tables {
+    size_t wallets = 0;
+    size_t users = 0;
+    std::vector<std::shared_ptr<WalletChunk>> walletChunks;
+    std::vector<std::shared_ptr<UserChunk>> userChunks;
+    BalanceTotals totals;
+    TopBalances top;
+};
+
+} // namespace detail
+
+class Snapshot {
+public:
+    Snapshot() = default;
+
+    uint64_t epoch() const { return seq; }
+    // Log entries stamped up to this second belong to the snapshot.
+    LogStamp asOf() const { return stamp; }
+
+    bool balance(int wallet_id, long long &out) const;
+    size_t walletCount() const { return tables ? tables->wallets : 0; }
+    size_t userCount() const { return tables ? tables->users : 0; }
+    BalanceTotals totals() const { return tables ? tables->totals : BalanceTotals(); }
+    // Up to n of the largest user balances as (wallet id, balance), largest
+    // first. Exact for n up to detail::TopBalances::kExact.
+    std::vector<std::pair<int, long long>> topBalances(size_t n) const;
+
+    // Wallets in id order, users in the order they were first seen.
+    template <class F>
+    void forEachWallet(F &&f) const {
+        if (!tables) return;
+        for (size_t c = 0; c < tables->walletChunks.size(); ++c) {
+            const detail::WalletChunk *chunk = tables->walletChunks[c].get();
+            if (!chunk) continue;
+            for (size_t i = 0; i < detail::WalletChunk::kRows; ++i)
+                if (chunk->present[i]) f(static_cast<int>(c * detail::WalletChunk::kRows + i), chunk->balance[i]);
+        }
+    }
+    template <class F>
+    void forEachUser(F &&f) const {
+        for (size_t i = 0; i < userCount(); ++i) {
+            const detail::UserChunk &chunk = *tables->userChunks[i / detail::UserChunk::kRows];
+            f(chunk.rows[i % detail::UserChunk::kRows]);
+        }
+    }
+
+private:
+    friend class SnapshotStore;
+
+    uint64_t seq = 0;
+    LogStamp stamp = 0;
+    std::shared_ptr<const detail::Tables> tables;
+};
+
+class SnapshotStore {
+public:
+    Snapshot snapshot();
+
+    void setBalance(int wallet_id, long long balance);
+    void setUser(const UserRow &row);
+    void addPendingTopUp(long long amount);
+    void setPendingTopUps(size_t requests, long long points);
+
+    // Keeps snapshots out until the returned lock is released, so a change
+    // of several rows, like both sides of a transfer, is seen whole.
+    std::unique_lock<std::recursive_mutex> batch() { return std::unique_lock<std::recursive_mutex>(lock); }
+
+private:
+    // Writers hold it for one row or one batch; snapshot() for taking a reference.
+    std::recursive_mutex lock;
+    uint64_t epoch = 0;
+    std::shared_ptr<detail::Tables> tables;
+    std::unordered_map<std::string_view, size_t> userSlots;
+
+    template <class T>
+    static T &writable(std::shared_ptr<T> &p);
+    static void rescanTop(detail::Tables &t);
+};
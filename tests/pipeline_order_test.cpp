@@ -0,0 +1,142 @@
+// Checks that Pipeline::approveTopUps takes approved requests out of
+// topup_requests.db only together with the credits that pay them, also when a
+// newer change is queued behind the approval and its job is the one that
+// commits. A watcher polls the files while the rounds run: a request gone
+// from topup_requests.db with its wallet still uncredited on disk, outside a
+// commit in progress, is what a crash at that moment would leave behind.
+//
+// Runs in a scratch directory under the system temp directory. Exits non-zero
+// on failure.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "async_ops.h"
+#include "text_loader.h"
+#include "wallet_core.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static constexpr int kRounds = 40;
+static constexpr int kFirstWallet = 10;    // receives round i's top-up
+static constexpr int kFirstSender = 1000;  // pays round i's transfer
+
+static string requestId(int round) {
+    string id = "r";
+    id += to_string(round);
+    return id;
+}
+
+// Balance of wallet on disk, 0 if it is not there.
+static long long diskBalance(int wallet) {
+    string buf;
+    long long balance = 0;
+    if (TextLoader::readFile("wallets.db", buf))
+        TextLoader::forEachWallet(buf, [&](int id, long long b) {
+            if (id == wallet) balance = b;
+        });
+    return balance;
+}
+
+static bool requestOnDisk(const string &id) {
+    string buf;
+    bool found = false;
+    if (TextLoader::readFile("topup_requests.db", buf))
+        TextLoader::forEachTopUp(buf, [&](string_view rid, int, long long, time_t) { found |= rid == id; });
+    return found;
+}
+
+int main() {
+    fs::path dir = fs::temp_directory_path() / "wallet_pipeline_order_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::path home = fs::current_path();
+    fs::current_path(dir);
+
+    int failures = 0;
+    {
+        Database db;
+        db.addWallet(2);
+        for (int i = 0; i < kRounds; ++i) {
+            db.addWallet(kFirstWallet + i);
+            // A sender per round, to stay clear of the transfer rate limit.
+            db.addWallet(kFirstSender + i, 1);
+        }
+        db.saveWallets();
+
+        atomic<int> round{-1};
+        atomic<bool> stop{false};
+        atomic<int> violations{0};
+        thread watcher([&] {
+            while (!stop) {
+                int r = round;
+                if (r < 0) continue;
+                string id = requestId(r);
+                if (requestOnDisk(id)) continue;
+                long long balance = diskBalance(kFirstWallet + r);
+                // Mid-commit the files are renamed one by one; the journal
+                // lets a restart finish the job, so that state is fine.
+                if (balance == 0 && !fs::exists("shards/journal.0.db")) ++violations;
+            }
+        });
+
+        Pipeline pipeline(db);
+        for (int i = 0; i < kRounds; ++i) {
+            string id = requestId(i);
+            if (!db.requestTopUp(id, kFirstWallet + i, 1, Env::now())) {
+                cerr << "request " << id << " refused\n";
+                ++failures;
+                break;
+            }
+            round = i;
+
+            // The approval holds the pipeline lock while it selects; the
+            // transfer is started then, so it changes the wallets right after
+            // the approval and before the approval's write job runs.
+            mutex m;
+            condition_variable cv;
+            bool selecting = false;
+            auto approval = pipeline.approveTopUps([&](const TopUpRequest &r) {
+                {
+                    lock_guard<mutex> guard(m);
+                    selecting = true;
+                }
+                cv.notify_all();
+                this_thread::sleep_for(chrono::milliseconds(20));
+                return r.request_id == id;
+            });
+            {
+                unique_lock<mutex> guard(m);
+                cv.wait(guard, [&] { return selecting; });
+            }
+            auto transfer = pipeline.transfer(kFirstSender + i, 2, 1);
+            if (approval.get().approved.size() != 1 || !transfer.get()) {
+                cerr << "round " << i << ": approval or transfer failed\n";
+                ++failures;
+            }
+            pipeline.flush().get();
+            if (requestOnDisk(id) || diskBalance(kFirstWallet + i) != 1) {
+                cerr << "round " << i << ": files not saved after flush\n";
+                ++failures;
+            }
+        }
+        stop = true;
+        watcher.join();
+        if (violations > 0) {
+            cerr << violations << " times a request was gone from disk before its credit\n";
+            ++failures;
+        }
+    }
+
+    fs::current_path(home);
+    fs::remove_all(dir);
+    if (failures == 0) cout << "pipeline order: ok\n";
+    return failures == 0 ? 0 : 1;
+}
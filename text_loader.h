@@ -0,0 +1,153 @@
+#pragma once
+
+// Allocation-free readers for the text database files (users.db, wallets.db,
+// topup_requests.db, admin_update_requests.db).
+//
+// Each file is read into memory with a single allocation, lines are found
+// with memchr (vectorised in every mainstream libc) and numbers are parsed
+// with std::from_chars, so there is no locale or per-token string work. The
+// parsers reproduce what the original stream code accepted:
+//   - users.db / wallets.db are whitespace-separated token streams (line
+//     breaks carry no meaning) and parsing stops at the first bad record;
+//   - topup_requests.db is parsed line by line and bad lines are skipped;
+//   - admin_update_requests.db lines are split on the first two '|'.
+
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+namespace TextLoader {
+
+// Reads the whole file into buf. Returns false if the file cannot be opened.
+// Text mode is kept on purpose so CRLF handling matches getline on Windows.
+inline bool readFile(const char *path, std::string &buf) {
+    std::ifstream ifs(path, std::ios::ate);
+    if (!ifs) return false;
+    std::streamoff size = ifs.tellg();
+    buf.resize(size > 0 ? static_cast<size_t>(size) : 0);
+    ifs.seekg(0);
+    ifs.read(&buf[0], static_cast<std::streamsize>(buf.size()));
+    buf.resize(static_cast<size_t>(ifs.gcount()));
+    return true;
+}
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Whitespace tokenizer, the equivalent of repeated `stream >> string`.
+class Tokenizer {
+public:
+    explicit Tokenizer(std::string_view text) : p(text.data()), end(text.data() + text.size()) {}
+
+    bool next(std::string_view &tok) {
+        while (p < end && isSpace(*p)) ++p;
+        if (p == end) return false;
+        const char *start = p;
+        while (p < end && !isSpace(*p)) ++p;
+        tok = std::string_view(start, static_cast<size_t>(p - start));
+        return true;
+    }
+
+private:
+    const char *p;
+    const char *end;
+};
+
+// Calls f(line) for every line, without the trailing '\n'. A final line
+// without a newline is reported; an empty tail after the last '\n' is not.
+template <class F>
+void forEachLine(std::string_view text, F &&f) {
+    const char *p = text.data();
+    const char *end = p + text.size();
+    while (p < end) {
+        const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        const char *stop = nl ? nl : end;
+        f(std::string_view(p, static_cast<size_t>(stop - p)));
+        p = nl ? nl + 1 : end;
+    }
+}
+
+template <class T>
+bool parseNumber(std::string_view tok, T &out) {
+    const char *first = tok.data();
+    const char *last = first + tok.size();
+    auto res = std::from_chars(first, last, out);
+    return res.ec == std::errc() && res.ptr == last;
+}
+
+// Matches `stream >> bool` with noboolalpha: only 0 and 1 are accepted.
+inline bool parseBool(std::string_view tok, bool &out) {
+    long v;
+    if (!parseNumber(tok, v) || (v != 0 && v != 1)) return false;
+    out = v != 0;
+    return true;
+}
+
+// f(username, password_hash, full_name, is_admin, wallet_id, must_change_password)
+template <class F>
+void forEachUser(std::string_view text, F &&f) {
+    Tokenizer t(text);
+    std::string_view uname, hashTok, fname, adminTok, widTok, forceTok;
+    while (t.next(uname) && t.next(hashTok) && t.next(fname) &&
+           t.next(adminTok) && t.next(widTok) && t.next(forceTok)) {
+        size_t pwd_hash;
+        bool admin, force;
+        int wid;
+        if (!parseNumber(hashTok, pwd_hash) || !parseBool(adminTok, admin) ||
+            !parseNumber(widTok, wid) || !parseBool(forceTok, force))
+            return;
+        f(uname, pwd_hash, fname, admin, wid, force);
+    }
+}
+
+// f(wallet_id, balance)
+template <class F>
+void forEachWallet(std::string_view text, F &&f) {
+    Tokenizer t(text);
+    std::string_view idTok, balTok;
+    while (t.next(idTok) && t.next(balTok)) {
+        int id;
+        long long bal;
+        if (!parseNumber(idTok, id) || !parseNumber(balTok, bal)) return;
+        f(id, bal);
+    }
+}
+
+// f(request_id, wallet_id, amount, timestamp); malformed lines are skipped.
+template <class F>
+void forEachTopUp(std::string_view text, F &&f) {
+    forEachLine(text, [&](std::string_view line) {
+        Tokenizer t(line);
+        std::string_view rid, widTok, amtTok, tsTok;
+        if (!(t.next(rid) && t.next(widTok) && t.next(amtTok) && t.next(tsTok))) return;
+        int wid;
+        long long amt, ts;
+        if (!parseNumber(widTok, wid) || !parseNumber(amtTok, amt) || !parseNumber(tsTok, ts)) return;
+        f(rid, wid, amt, static_cast<time_t>(ts));
+    });
+}
+
+// f(line, otp, username, full_name) for every line, including empty ones.
+template <class F>
+void forEachUpdateRequest(std::string_view text, F &&f) {
+    forEachLine(text, [&](std::string_view line) {
+        std::string_view otp = line, username, fullname;
+        size_t a = line.find('|');
+        if (a != std::string_view::npos) {
+            otp = line.substr(0, a);
+            username = line.substr(a + 1);
+            size_t b = username.find('|');
+            if (b != std::string_view::npos) {
+                fullname = username.substr(b + 1);
+                username = username.substr(0, b);
+            }
+        }
+        f(line, otp, username, fullname);
+    });
+}
+
+} // namespace TextLoader
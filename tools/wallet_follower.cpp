@@ -0,0 +1,53 @@
+// Keeps a follower copy of the wallet balances in sync with a running
+// wallet_final by tailing its transaction log. Run it in the same directory
+// as wallet_final; reports can then read <dir>/wallets.db without touching
+// the primary's files.
+//
+//   wallet_follower [--dir follower] [--interval-ms 1000] [--polls 0]
+//
+// --polls 0 follows until killed; --polls 1 catches up once and exits.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "follower.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+    Follower::Config cfg;
+    unsigned long long intervalMs = 1000;
+    unsigned long long polls = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        string value = argv[i + 1];
+        if (flag == "--dir") cfg.dir = value;
+        else if (flag == "--interval-ms") intervalMs = strtoull(value.c_str(), nullptr, 10);
+        else if (flag == "--polls") polls = strtoull(value.c_str(), nullptr, 10);
+        else {
+            cerr << "Unknown option " << flag << endl;
+            return 2;
+        }
+    }
+
+    Follower follower(cfg);
+    if (follower.load())
+        cout << "Resuming after " << follower.linesApplied() << " log lines" << endl;
+
+    for (unsigned long long n = 0; polls == 0 || n < polls; ++n) {
+        if (n) this_thread::sleep_for(chrono::milliseconds(intervalMs));
+        size_t lines = follower.poll();
+        if (lines == 0 && n) continue;
+        if (!follower.save()) {
+            cerr << "Failed to write " << cfg.dir << endl;
+            return 1;
+        }
+        if (lines)
+            cout << "Applied " << lines << " log lines, " << follower.balances().size() << " wallets" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,405 @@
+// Workload generator and deterministic replay for the whole system.
+//
+//   wallet_loadgen generate [--ops 100000] [--users 1000] [--rate 200] [--zipf 1.1]
+//                           [--mix register=2,login=20,transfer=60,topup_request=15,approve=3]
+//                           [--seed 1] [--start 1767225600] [--central 1000000000]
+//                           [--out workload.txt]
+//   wallet_loadgen replay   [--trace workload.txt] [--dir replay_run]
+//
+// generate writes a trace: a header line, then one operation per line with
+// its offset from --start in milliseconds of simulated time. The first
+// --users operations register users; after that operations are drawn from
+// --mix (relative weights) with Poisson arrivals at --rate per simulated
+// second, and pick users by a Zipf distribution with exponent --zipf over
+// registration order, so the earliest users are the busiest (0 = uniform).
+//
+// replay runs a trace against a new Database in --dir, which must not exist
+// or be empty, making the same calls the menus make. Before each operation
+// the clock is set from the trace; the engine behind OTPs and generated
+// passwords is seeded from the header and TZ is UTC. Two replays of one trace
+// therefore leave identical files. It prints the count, failures and
+// wall-clock latency of each kind of operation, and a digest of every file
+// the run wrote: an unchanged digest across builds means unchanged
+// behaviour. OTPs and generated passwords are drawn without library
+// distributions, so that holds across compilers too, except for what the
+// standard library decides: users.db holds std::hash password hashes in
+// unordered_map order and idempotency.db std::hash fingerprints. Compare
+// digests between builds on the same standard library.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "async_ops.h"
+#include "env.h"
+#include "text_loader.h"
+#include "wallet_core.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+enum Op { Register, Login, Transfer, RequestTopUp, Approve, kOps };
+const char *const kOpNames[kOps] = {"register", "login", "transfer", "topup_request", "approve"};
+
+struct Event {
+    uint64_t ms = 0;
+    Op op = Register;
+    size_t user = 0;  // register, login, transfer source, topup_request
+    size_t to = 0;    // transfer destination
+    long long amount = 0;
+};
+
+struct Header {
+    uint32_t seed = 1;
+    time_t start = 1767225600;  // 2026-01-01 00:00:00 UTC
+    long long central = 1000000000;
+};
+
+string username(size_t user) {
+    return "load" + to_string(user);
+}
+
+// Rank in [0, n) with P(k) roughly proportional to 1 / (k + 1)^s, by
+// inverting the integral of x^-s over [1, n + 1].
+size_t zipf(size_t n, double s, mt19937_64 &gen) {
+    double u = uniform_real_distribution<double>(0, 1)(gen);
+    double x;
+    if (s <= 0) x = 1 + u * n;
+    else if (fabs(s - 1) < 1e-9) x = exp(u * log(n + 1.0));
+    else x = pow(1 + u * (pow(n + 1.0, 1 - s) - 1), 1 / (1 - s));
+    return min(n - 1, static_cast<size_t>(x) - 1);
+}
+
+bool parseMix(const string &s, double weights[kOps]) {
+    fill(weights, weights + kOps, 0.0);
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == string::npos) return false;
+        string name = item.substr(0, eq);
+        auto it = find(kOpNames, kOpNames + kOps, name);
+        if (it == kOpNames + kOps) return false;
+        weights[it - kOpNames] = strtod(item.c_str() + eq + 1, nullptr);
+    }
+    return true;
+}
+
+int generate(int argc, char **argv) {
+    size_t ops = 100000, users = 1000;
+    double rate = 200, skew = 1.1;
+    double weights[kOps];
+    parseMix("register=2,login=20,transfer=60,topup_request=15,approve=3", weights);
+    Header h;
+    string out = "workload.txt";
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        string value = argv[i + 1];
+        if (flag == "--ops") ops = strtoull(value.c_str(), nullptr, 10);
+        else if (flag == "--users") users = strtoull(value.c_str(), nullptr, 10);
+        else if (flag == "--rate") rate = strtod(value.c_str(), nullptr);
+        else if (flag == "--zipf") skew = strtod(value.c_str(), nullptr);
+        else if (flag == "--seed") h.seed = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        else if (flag == "--start") h.start = static_cast<time_t>(strtoll(value.c_str(), nullptr, 10));
+        else if (flag == "--central") h.central = strtoll(value.c_str(), nullptr, 10);
+        else if (flag == "--out") out = value;
+        else if (flag == "--mix") {
+            if (!parseMix(value, weights)) {
+                cerr << "Bad --mix " << value << endl;
+                return 2;
+            }
+        } else {
+            cerr << "Unknown option " << flag << endl;
+            return 2;
+        }
+    }
+    if (rate <= 0) rate = 1;
+
+    ofstream f(out, ios::trunc);
+    if (!f) {
+        cerr << "Cannot write " << out << endl;
+        return 1;
+    }
+    f << "wallet_loadgen 1 " << h.seed << ' ' << h.start << ' ' << h.central << '\n';
+    mt19937_64 gen(h.seed);
+    exponential_distribution<double> gap(rate);
+    discrete_distribution<int> pick(weights, weights + kOps);
+    double t = 0;
+    size_t population = 0;
+    for (size_t i = 0; i < ops; ++i) {
+        Op op = i < users ? Register : static_cast<Op>(pick(gen));
+        if (op != Register && op != Approve && population < 2) op = Register;
+        uint64_t ms = static_cast<uint64_t>(t * 1000);
+        f << ms << ' ' << kOpNames[op];
+        switch (op) {
+        case Register: f << ' ' << population++; break;
+        case Login: f << ' ' << zipf(population, skew, gen); break;
+        case Transfer: {
+            size_t from = zipf(population, skew, gen);
+            size_t to = zipf(population, skew, gen);
+            if (to == from) to = (from + 1) % population;
+            f << ' ' << from << ' ' << to << ' ' << 1 + gen() % 100;
+            break;
+        }
+        case RequestTopUp: f << ' ' << zipf(population, skew, gen) << ' ' << 10 + gen() % 991; break;
+        case Approve: case kOps: break;
+        }
+        f << '\n';
+        if (i >= users) t += gap(gen);
+    }
+    cout << "Wrote " << ops << " operations over " << t << " simulated seconds to " << out << endl;
+    return 0;
+}
+
+bool readTrace(const string &path, Header &h, vector<Event> &events) {
+    string buf;
+    if (!TextLoader::readFile(path.c_str(), buf)) return false;
+    bool first = true, ok = true;
+    TextLoader::forEachLine(buf, [&](string_view line) {
+        TextLoader::Tokenizer t(line);
+        string_view tok[5];
+        size_t n = 0;
+        while (n < 5 && t.next(tok[n])) ++n;
+        if (n == 0) return;
+        if (first) {
+            first = false;
+            ok = n == 5 && tok[0] == "wallet_loadgen" && tok[1] == "1" && TextLoader::parseNumber(tok[2], h.seed) &&
+                 TextLoader::parseNumber(tok[3], h.start) && TextLoader::parseNumber(tok[4], h.central);
+            return;
+        }
+        Event e;
+        auto it = find(kOpNames, kOpNames + kOps, tok[1]);
+        if (!ok || n < 2 || !TextLoader::parseNumber(tok[0], e.ms) || it == kOpNames + kOps) {
+            ok = false;
+            return;
+        }
+        e.op = static_cast<Op>(it - kOpNames);
+        size_t want = e.op == Transfer ? 5 : e.op == RequestTopUp ? 4 : e.op == Approve ? 2 : 3;
+        if (n != want || (want > 2 && !TextLoader::parseNumber(tok[2], e.user)) ||
+            (e.op == Transfer && (!TextLoader::parseNumber(tok[3], e.to) || !TextLoader::parseNumber(tok[4], e.amount))) ||
+            (e.op == RequestTopUp && !TextLoader::parseNumber(tok[3], e.amount))) {
+            ok = false;
+            return;
+        }
+        events.push_back(e);
+    });
+    return ok && !first;
+}
+
+// Makes localtime() UTC for this process, so stamps do not depend on where
+// the replay runs.
+void useUtc() {
+#ifdef _WIN32
+    _putenv_s("TZ", "UTC0");
+    _tzset();
+#else
+    setenv("TZ", "UTC", 1);
+    tzset();
+#endif
+}
+
+// FNV-1a over the relative path and contents of every file under dir, in
+// path order.
+uint64_t digestDir(const fs::path &dir) {
+    vector<fs::path> files;
+    for (auto &e : fs::recursive_directory_iterator(dir))
+        if (e.is_regular_file()) files.push_back(fs::relative(e.path(), dir));
+    sort(files.begin(), files.end());
+    uint64_t h = 1469598103934665603ULL;
+    auto mixIn = [&](string_view s) {
+        for (unsigned char c : s) h = (h ^ c) * 1099511628211ULL;
+        h = (h ^ 0xff) * 1099511628211ULL;
+    };
+    string buf;
+    for (const fs::path &p : files) {
+        mixIn(p.generic_string());
+        TextLoader::readFile((dir / p).string().c_str(), buf);
+        mixIn(buf);
+    }
+    return h;
+}
+
+// One session's worth of state the menus would keep between operations.
+class Replayer {
+public:
+    explicit Replayer(Database &db) : db(db), pipeline(db) {}
+
+    bool run(const Event &e) {
+        switch (e.op) {
+        case Register: return registerUser(e.user);
+        case Login: return login(e.user);
+        case Transfer: return transfer(e.user, e.to, e.amount);
+        case RequestTopUp: return requestTopUp(e.user, e.amount);
+        case Approve: return approve();
+        case kOps: break;
+        }
+        return false;
+    }
+
+    void flush() { pipeline.flush().get(); }
+
+private:
+    Database &db;
+    Pipeline pipeline;
+    vector<string> passwords;  // by user
+
+    User *find(size_t user) {
+        auto it = db.users.find(username(user));
+        return it == db.users.end() ? nullptr : &it->second;
+    }
+
+    // As registerUser in wallet_final.cpp, with a generated password.
+    bool registerUser(size_t user) {
+        db.loadUsers();
+        db.loadWallets();
+        string name = username(user);
+        if (db.users.count(name)) return false;
+        string pwd = OTPService::generateOTP(10);
+        int wid = db.next_wallet_id++;
+        db.addUser(name, pwd, "Load" + to_string(user), false, wid, true);
+        db.addWallet(wid);
+        db.saveUsers();
+        db.saveWallets();
+        if (passwords.size() <= user) passwords.resize(user + 1);
+        passwords[user] = pwd;
+        return true;
+    }
+
+    // As login, including the forced change of a generated password.
+    bool login(size_t user) {
+        db.loadUsers();
+        User *u = find(user);
+        if (!u || user >= passwords.size() || !u->checkPassword(passwords[user])) return false;
+        if (u->must_change_password) {
+            passwords[user] = OTPService::generateOTP(10);
+            u->setPassword(passwords[user]);
+            u->must_change_password = false;
+            db.saveUsers();
+        }
+        return true;
+    }
+
+    // As transferPoints, with the OTP entered correctly.
+    bool transfer(size_t from, size_t to, long long amount) {
+        db.loadWallets();
+        User *src = find(from);
+        User *dest = find(to);
+        if (!src || !dest || !db.wallets.count(dest->wallet_id)) return false;
+        if (db.limits.transfers.check(src->wallet_id, amount, Env::now()) != RateLimiter::Verdict::Allowed)
+            return false;
+        string code = OTPService::generateOTP(6);
+        if (!OTPService::verifyOTP(code, code)) return false;
+        return pipeline.transfer(src->wallet_id, dest->wallet_id, amount).get();
+    }
+
+    // As userRequestTopUp.
+    bool requestTopUp(size_t user, long long amount) {
+        User *u = find(user);
+        if (!u || db.limits.topUpRequests.check(u->wallet_id, amount, Env::now()) != RateLimiter::Verdict::Allowed)
+            return false;
+        string id;
+        do {
+            id = OTPService::generateOTP(8);
+        } while (db.topUpRequestExists(id));
+        return db.requestTopUp(id, u->wallet_id, amount, Env::now());
+    }
+
+    // As adminApproveTopUps, approving everything pending.
+    bool approve() {
+        TopUpApproval result = pipeline.approveTopUps([](const TopUpRequest &) { return true; }).get();
+        return !result.approved.empty();
+    }
+};
+
+int replay(int argc, char **argv) {
+    string trace = "workload.txt";
+    string dir = "replay_run";
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        string value = argv[i + 1];
+        if (flag == "--trace") trace = value;
+        else if (flag == "--dir") dir = value;
+        else {
+            cerr << "Unknown option " << flag << endl;
+            return 2;
+        }
+    }
+
+    Header h;
+    vector<Event> events;
+    if (!readTrace(trace, h, events)) {
+        cerr << "Cannot read trace " << trace << endl;
+        return 1;
+    }
+    error_code ec;
+    if (fs::exists(dir, ec) && !fs::is_empty(dir, ec)) {
+        cerr << dir << " is not empty; replays start from an empty directory" << endl;
+        return 1;
+    }
+    fs::create_directories(dir, ec);
+    fs::path root = fs::absolute(dir);
+    fs::current_path(root);
+
+    useUtc();
+    Env::seed(h.seed);
+    Env::setTime(h.start);
+    ofstream("wallets.db", ios::trunc) << 0 << ' ' << h.central << '\n';
+
+    vector<double> latency[kOps];
+    size_t failed[kOps] = {};
+    auto begin = chrono::steady_clock::now();
+    uint64_t digest;
+    {
+        Database db;
+        {
+            Replayer session(db);
+            for (const Event &e : events) {
+                Env::setTime(h.start + static_cast<time_t>(e.ms / 1000));
+                auto t0 = chrono::steady_clock::now();
+                if (!session.run(e)) ++failed[e.op];
+                latency[e.op].push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+            }
+            session.flush();
+        }
+        // Before the destructor renames the files to their backups.
+        digest = digestDir(root);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    printf("%-14s %9s %9s %10s %10s %10s\n", "op", "count", "failed", "avg_us", "p50_us", "p99_us");
+    for (int op = 0; op < kOps; ++op) {
+        vector<double> &v = latency[op];
+        if (v.empty()) continue;
+        double sum = 0;
+        for (double x : v) sum += x;
+        sort(v.begin(), v.end());
+        printf("%-14s %9zu %9zu %10.1f %10.1f %10.1f\n", kOpNames[op], v.size(), failed[op], sum / v.size(),
+               v[v.size() / 2], v[min(v.size() - 1, v.size() * 99 / 100)]);
+    }
+    printf("%zu operations in %.2f s (%.0f ops/s)\n", events.size(), seconds, events.size() / seconds);
+    printf("digest %016llx\n", static_cast<unsigned long long>(digest));
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode == "generate") return generate(argc, argv);
+    if (mode == "replay") return replay(argc, argv);
+    cerr << "Usage: wallet_loadgen generate|replay [options]" << endl;
+    return 2;
+}
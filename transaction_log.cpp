@@ -0,0 +1,448 @@
+#include "transaction_log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+
+#include "env.h"
+#include "lz.h"
+#include "mix.h"
+#include "text_loader.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+const char kSegmentMagic[4] = {'W', 'L', 'Z', '1'};
+
+uint64_t fileSize(const string &path) {
+    error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+// Lines containing match that start before end, newest first, as
+// f(line, start) until f returns false. Returns false if f stopped it. Works
+// back a chunk at a time, finding the matches in each with a forward search,
+// so lines of other wallets cost no more than a forward scan.
+template <class F>
+bool forEachMatchBack(string_view text, size_t end, string_view match, F &&f) {
+    constexpr size_t kChunk = 64 * 1024;
+    vector<pair<size_t, size_t>> hits;  // start, length
+    size_t hi = min(end, text.size());
+    while (hi > 0) {
+        size_t lo = hi > kChunk ? hi - kChunk : 0;
+        if (lo > 0) {
+            size_t nl = text.rfind('\n', lo - 1);
+            lo = nl == string_view::npos ? 0 : nl + 1;
+        }
+        hits.clear();
+        for (size_t p = text.find(match, lo); p != string_view::npos && p < hi; p = text.find(match, p + 1)) {
+            size_t nl = p == 0 ? string_view::npos : text.rfind('\n', p - 1);
+            size_t start = nl == string_view::npos ? 0 : nl + 1;
+            size_t stop = text.find('\n', p);
+            if (stop == string_view::npos) stop = text.size();
+            if (hits.empty() || hits.back().first != start) hits.push_back({start, stop - start});
+            p = stop;
+        }
+        for (auto it = hits.rbegin(); it != hits.rend(); ++it)
+            if (!f(text.substr(it->first, it->second), it->first)) return false;
+        hi = lo;
+    }
+    return true;
+}
+
+// forEachMatchBack over a file, read from end towards the start in blocks.
+template <class F>
+bool forEachFileMatchBack(const string &path, uint64_t end, string_view match, F &&f) {
+    constexpr uint64_t kBlock = 256 * 1024;
+    ifstream in(path, ios::binary);
+    if (!in) return true;
+    uint64_t pos = min(end, fileSize(path));
+    string block, carry;  // carry: the start of the line the previous block cut
+    while (pos > 0) {
+        uint64_t n = min(kBlock, pos);
+        pos -= n;
+        block.resize(n);
+        in.seekg(static_cast<streamoff>(pos));
+        in.read(&block[0], static_cast<streamsize>(n));
+        if (static_cast<uint64_t>(in.gcount()) != n) return true;
+        block += carry;
+        // The first line may begin in the block before; it waits for that one.
+        size_t first = 0;
+        if (pos > 0) {
+            size_t nl = block.find('\n');
+            if (nl == string::npos) {
+                carry.swap(block);
+                continue;
+            }
+            first = nl + 1;
+        }
+        string_view text = string_view(block).substr(first);
+        uint64_t base = pos + first;
+        if (!forEachMatchBack(text, text.size(), match,
+                              [&](string_view line, size_t start) { return f(line, base + start); }))
+            return false;
+        carry.assign(block, 0, first);
+    }
+    return true;
+}
+
+bool readDigits(string_view s, size_t pos, size_t count, uint64_t &acc) {
+    if (pos + count > s.size()) return false;
+    for (size_t i = pos; i < pos + count; ++i) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        acc = acc * 10 + static_cast<uint64_t>(s[i] - '0');
+    }
+    return true;
+}
+
+string bloomToHex(const bitset<SegmentInfo::kBloomBits> &bits) {
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    hex.reserve(SegmentInfo::kBloomBits / 4);
+    for (size_t i = 0; i < SegmentInfo::kBloomBits; i += 4) {
+        unsigned v = bits[i] | bits[i + 1] << 1 | bits[i + 2] << 2 | bits[i + 3] << 3;
+        hex.push_back(digits[v]);
+    }
+    return hex;
+}
+
+bool bloomFromHex(string_view hex, bitset<SegmentInfo::kBloomBits> &bits) {
+    if (hex.size() != SegmentInfo::kBloomBits / 4) return false;
+    for (size_t i = 0; i < hex.size(); ++i) {
+        char c = hex[i];
+        unsigned v;
+        if (c >= '0' && c <= '9') v = static_cast<unsigned>(c - '0');
+        else if (c >= 'a' && c <= 'f') v = static_cast<unsigned>(c - 'a' + 10);
+        else return false;
+        for (unsigned b = 0; b < 4; ++b) bits[i * 4 + b] = (v >> b) & 1;
+    }
+    return true;
+}
+
+} // namespace
+
+void SegmentInfo::addWallet(int wallet_id) {
+    uint64_t h = mix(static_cast<uint64_t>(wallet_id));
+    wallets.set(h % kBloomBits);
+    wallets.set((h >> 32) % kBloomBits);
+}
+
+bool SegmentInfo::mayContain(int wallet_id) const {
+    if (wallet_id < min_wallet || wallet_id > max_wallet) return false;
+    uint64_t h = mix(static_cast<uint64_t>(wallet_id));
+    return wallets.test(h % kBloomBits) && wallets.test((h >> 32) % kBloomBits);
+}
+
+TransactionLog::TransactionLog() : TransactionLog(Config()) {}
+
+TransactionLog::TransactionLog(Config config) : cfg(std::move(config)) {}
+
+LogStamp TransactionLog::stampOf(time_t t) {
+    tm local = *localtime(&t);
+    return (((((static_cast<LogStamp>(local.tm_year + 1900) * 100 + local.tm_mon + 1) * 100 +
+               local.tm_mday) * 100 + local.tm_hour) * 100 + local.tm_min) * 100 + local.tm_sec);
+}
+
+bool TransactionLog::parseLine(string_view line, LogStamp &ts, int &wallet_id) {
+    // [YYYY-MM-DD HH:MM:SS] Wallet <id>: ...
+    static const char kPrefix[] = "] Wallet ";
+    if (line.size() < 21 || line[0] != '[') return false;
+    uint64_t v = 0;
+    if (!readDigits(line, 1, 4, v) || !readDigits(line, 6, 2, v) || !readDigits(line, 9, 2, v) ||
+        !readDigits(line, 12, 2, v) || !readDigits(line, 15, 2, v) || !readDigits(line, 18, 2, v))
+        return false;
+    if (line.compare(20, sizeof(kPrefix) - 1, kPrefix) != 0) return false;
+    string_view rest = line.substr(20 + sizeof(kPrefix) - 1);
+    size_t colon = rest.find(':');
+    if (colon == string_view::npos || !TextLoader::parseNumber(rest.substr(0, colon), wallet_id)) return false;
+    ts = v;
+    return true;
+}
+
+string TransactionLog::manifestPath() const {
+    return (fs::path(cfg.dir) / "manifest.db").string();
+}
+
+string TransactionLog::segmentPath(uint32_t seq) const {
+    char name[32];
+    snprintf(name, sizeof(name), "segment-%06u", seq);
+    return (fs::path(cfg.dir) / name).string();
+}
+
+void TransactionLog::loadManifest() {
+    string path = manifestPath();
+    uint64_t size = fileSize(path);
+    if (size == manifestSize) return;
+    manifest.clear();
+    manifestSize = size;
+
+    string buf;
+    if (!TextLoader::readFile(path.c_str(), buf)) return;
+    TextLoader::forEachLine(buf, [&](string_view line) {
+        TextLoader::Tokenizer t(line);
+        string_view tok[9];
+        for (auto &x : tok)
+            if (!t.next(x)) return;
+        SegmentInfo s;
+        if (!TextLoader::parseNumber(tok[0], s.seq) || !TextLoader::parseNumber(tok[1], s.first_ts) ||
+            !TextLoader::parseNumber(tok[2], s.last_ts) || !TextLoader::parseNumber(tok[3], s.min_wallet) ||
+            !TextLoader::parseNumber(tok[4], s.max_wallet) || !TextLoader::parseNumber(tok[5], s.lines) ||
+            !TextLoader::parseNumber(tok[6], s.raw_bytes) || !TextLoader::parseNumber(tok[7], s.stored_bytes) ||
+            !bloomFromHex(tok[8], s.wallets))
+            return;
+        manifest.push_back(s);
+    });
+}
+
+vector<SegmentInfo> TransactionLog::segments() {
+    lock_guard<mutex> guard(lock);
+    loadManifest();
+    return manifest;
+}
+
+LogStamp TransactionLog::readActiveDay() {
+    uint64_t size = fileSize(cfg.activePath);
+    if (size == 0) {
+        activeDay = 0;
+        lastActiveSize = 0;
+        return 0;
+    }
+    // A file that shrank was sealed by another process since we last looked.
+    if (activeDay != 0 && size >= lastActiveSize) return activeDay;
+
+    ifstream ifs(cfg.activePath);
+    string first;
+    getline(ifs, first);
+    LogStamp ts;
+    int wid;
+    activeDay = parseLine(first, ts, wid) ? ts / 1000000 : 0;
+    lastActiveSize = size;
+    return activeDay;
+}
+
+void TransactionLog::append(int wallet_id, const string &entry) {
+    append(vector<LogEntry>{{wallet_id, entry}}, Env::now());
+}
+
+void TransactionLog::append(const vector<LogEntry> &entries, time_t now) {
+    if (entries.empty()) return;
+    lock_guard<mutex> guard(lock);
+    LogStamp day = stampOf(now) / 1000000;
+    if (cfg.rotateDaily) {
+        LogStamp active = readActiveDay();
+        if (active != 0 && active != day) sealLocked();
+    }
+
+    char stamp[64];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    string prefix = "[";
+    prefix += stamp;
+    prefix += "] Wallet ";
+    string buf;
+    uint64_t size = fileSize(cfg.activePath);
+    size_t next = 0;
+    while (next < entries.size()) {
+        // Fill the active segment up to its limit, then seal and go on, so
+        // a large batch still ends up in segments of the usual size.
+        buf.clear();
+        for (; next < entries.size() && (buf.empty() || size + buf.size() < cfg.maxSegmentBytes); ++next) {
+            buf += prefix;
+            buf += to_string(entries[next].wallet_id);
+            buf += ": ";
+            buf += entries[next].text;
+            buf += '\n';
+        }
+        {
+            ofstream logf(cfg.activePath, ios::app);
+            if (!logf) return;
+            logf.write(buf.data(), static_cast<streamsize>(buf.size()));
+        }
+
+        size = fileSize(cfg.activePath);
+        if (activeDay == 0 || size < lastActiveSize) activeDay = day;
+        lastActiveSize = size;
+        if (size >= cfg.maxSegmentBytes && sealLocked()) size = 0;
+    }
+}
+
+bool TransactionLog::seal() {
+    lock_guard<mutex> guard(lock);
+    return sealLocked();
+}
+
+bool TransactionLog::sealLocked() {
+    error_code ec;
+    fs::create_directories(cfg.dir, ec);
+    loadManifest();
+    uint32_t seq = manifest.empty() ? 1 : manifest.back().seq + 1;
+
+    // A .log left behind by an interrupted seal is finished first, so it
+    // keeps its place in the sequence.
+    string pending = segmentPath(seq) + ".log";
+    if (!fs::exists(pending) && rename(cfg.activePath.c_str(), pending.c_str()) != 0) return false;
+    activeDay = 0;
+    lastActiveSize = 0;
+
+    string buf;
+    TextLoader::readFile(pending.c_str(), buf);
+    if (buf.empty()) {
+        remove(pending.c_str());
+        return false;
+    }
+
+    SegmentInfo info;
+    info.seq = seq;
+    info.raw_bytes = buf.size();
+    info.first_ts = UINT64_MAX;
+    info.min_wallet = INT32_MAX;
+    info.max_wallet = INT32_MIN;
+    bool unparsed = false;
+    TextLoader::forEachLine(buf, [&](string_view line) {
+        ++info.lines;
+        LogStamp ts;
+        int wid;
+        if (!parseLine(line, ts, wid)) {
+            unparsed = true;
+            return;
+        }
+        info.first_ts = min(info.first_ts, ts);
+        info.last_ts = max(info.last_ts, ts);
+        info.min_wallet = min(info.min_wallet, wid);
+        info.max_wallet = max(info.max_wallet, wid);
+        info.addWallet(wid);
+    });
+    if (unparsed) {
+        // Readers match such lines by their text, so the segment may hold
+        // any wallet at any time and must never be skipped.
+        info.first_ts = 0;
+        info.last_ts = UINT64_MAX;
+        info.min_wallet = INT32_MIN;
+        info.max_wallet = INT32_MAX;
+        info.wallets.set();
+    }
+    if (info.first_ts == UINT64_MAX) info.first_ts = 0;
+    if (info.min_wallet > info.max_wallet) info.min_wallet = info.max_wallet = 0;
+
+    string packed = lz::compress(buf);
+    string lzPath = segmentPath(seq) + ".lz";
+    {
+        ofstream out(lzPath, ios::binary | ios::trunc);
+        char header[12];
+        memcpy(header, kSegmentMagic, 4);
+        uint64_t raw = info.raw_bytes;
+        for (int i = 0; i < 8; ++i) header[4 + i] = static_cast<char>((raw >> (8 * i)) & 0xff);
+        out.write(header, sizeof(header));
+        out.write(packed.data(), static_cast<streamsize>(packed.size()));
+        if (!out) return false;
+    }
+    info.stored_bytes = fileSize(lzPath);
+
+    {
+        ofstream man(manifestPath(), ios::app);
+        man << info.seq << ' ' << info.first_ts << ' ' << info.last_ts << ' ' << info.min_wallet << ' '
+            << info.max_wallet << ' ' << info.lines << ' ' << info.raw_bytes << ' ' << info.stored_bytes << ' '
+            << bloomToHex(info.wallets) << '\n';
+    }
+    remove(pending.c_str());
+    manifest.push_back(info);
+    manifestSize = fileSize(manifestPath());
+    return true;
+}
+
+bool TransactionLog::readSegment(const SegmentInfo &seg, string &out) const {
+    ifstream in(segmentPath(seg.seq) + ".lz", ios::binary);
+    if (!in) return false;
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if (data.size() < 12 || memcmp(data.data(), kSegmentMagic, 4) != 0) return false;
+    uint64_t raw = 0;
+    for (int i = 0; i < 8; ++i) raw |= static_cast<uint64_t>(static_cast<unsigned char>(data[4 + i])) << (8 * i);
+    return lz::decompress(string_view(data).substr(12), raw, out);
+}
+
+bool TransactionLog::forEach(int wallet_id, const function<void(string_view)> &f, LogStamp from, LogStamp to) {
+    string match = "Wallet " + to_string(wallet_id) + ":";
+    bool bounded = from != 0 || to != UINT64_MAX;
+    auto scan = [&](string_view text) {
+        TextLoader::forEachLine(text, [&](string_view line) {
+            if (line.find(match) == string_view::npos) return;
+            if (bounded) {
+                LogStamp ts;
+                int wid;
+                if (parseLine(line, ts, wid) && (ts < from || ts > to)) return;
+            }
+            f(line);
+        });
+    };
+
+    lock_guard<mutex> guard(lock);
+    loadManifest();
+    bool found = false;
+    string buf;
+    for (const SegmentInfo &seg : manifest) {
+        found = true;
+        if (!seg.overlaps(from, to) || !seg.mayContain(wallet_id)) continue;
+        if (readSegment(seg, buf)) scan(buf);
+    }
+    if (TextLoader::readFile(cfg.activePath.c_str(), buf)) {
+        found = true;
+        scan(buf);
+    }
+    return found;
+}
+
+HistoryPage TransactionLog::page(int wallet_id, size_t size, LogCursor from, LogStamp to) {
+    string match = "Wallet " + to_string(wallet_id) + ":";
+    HistoryPage page;
+    auto take = [&](uint32_t seq, string_view line, uint64_t start) {
+        LogStamp ts;
+        int wid;
+        if (to != UINT64_MAX && parseLine(line, ts, wid) && ts > to) return true;
+        page.lines.emplace_back(line);
+        page.next = {seq, start};
+        return page.lines.size() < size;
+    };
+    if (size == 0) return page;
+
+    lock_guard<mutex> guard(lock);
+    loadManifest();
+    uint32_t active = manifest.empty() ? 1 : manifest.back().seq + 1;
+    uint32_t seq = min(from.seq, active);
+    uint64_t end = from.seq > active ? UINT64_MAX : from.offset;
+    bool full = false;
+    if (seq == active) {
+        full = !forEachFileMatchBack(cfg.activePath, end, match,
+                                     [&](string_view line, uint64_t start) { return take(active, line, start); });
+        end = UINT64_MAX;
+    }
+    for (auto it = manifest.rbegin(); !full && it != manifest.rend(); ++it) {
+        const SegmentInfo &seg = *it;
+        if (seg.seq > seq || seg.first_ts > to || !seg.mayContain(wallet_id)) continue;
+        bool cached = seg.seq == pageSegment.seq && seg.raw_bytes == pageSegment.raw_bytes &&
+                      seg.stored_bytes == pageSegment.stored_bytes && !pageText.empty();
+        if (!cached) {
+            pageSegment = seg;
+            if (!readSegment(seg, pageText)) {
+                pageText.clear();
+                continue;
+            }
+        }
+        full = !forEachMatchBack(pageText, seg.seq == seq ? end : UINT64_MAX, match,
+                                 [&](string_view line, size_t start) { return take(seg.seq, line, start); });
+    }
+    page.more = full;
+    if (!full) page.next = {0, 0};
+    return page;
+}
+
+TransactionLog &transactionLog() {
+    // Never destroyed, so the I/O thread can still append while globals are
+    // being torn down at exit.
+    static TransactionLog *log = new TransactionLog();
+    return *log;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+// Segmented transaction log.
+//
+// New entries are appended to the active segment, transaction.db, in the same
+// "[YYYY-MM-DD HH:MM:SS] Wallet <id>: <entry>" format as before. When the
+// active segment passes maxSegmentBytes, or a new calendar day starts, it is
+// sealed: moved into txlog/, compressed with lz, and described by one line in
+// txlog/manifest.db (time range, wallet id range, a bloom filter of the
+// wallet ids and the sizes). History queries read the manifest first and only
+// decompress the segments that can contain a match.
+
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Timestamps inside the log are kept as YYYYMMDDhhmmss numbers, which sort
+// the same way as the text stamps and need no time zone handling.
+using LogStamp = uint64_t;
+
+// A transaction log line that still has to be written.
+struct LogEntry {
+    int wallet_id;
+    std::string text;
+};
+
+struct SegmentInfo {
+    static constexpr size_t kBloomBits = 1024;
+
+    uint32_t seq = 0;
+    LogStamp first_ts = 0;
+    LogStamp last_ts = 0;
+    int min_wallet = 0;
+    int max_wallet = 0;
+    uint64_t lines = 0;
+    uint64_t raw_bytes = 0;
+    uint64_t stored_bytes = 0;
+    std::bitset<kBloomBits> wallets;
+
+    void addWallet(int wallet_id);
+    bool mayContain(int wallet_id) const;
+    bool overlaps(LogStamp from, LogStamp to) const { return first_ts <= to && last_ts >= from; }
+};
+
+// Where a page of history stopped. Pages walk from the newest line towards
+// the oldest; a cursor is the byte offset of the last line returned within
+// its segment. The active file is addressed by the number it gets when it is
+// sealed, and sealing keeps its bytes, so a cursor stays valid across a seal.
+struct LogCursor {
+    uint32_t seq = UINT32_MAX;     // UINT32_MAX: start from the newest line
+    uint64_t offset = UINT64_MAX;  // lines that start before this offset
+};
+
+struct HistoryPage {
+    std::vector<std::string> lines;  // newest first
+    LogCursor next;                  // pass back for the following page
+    bool more = false;               // older lines may follow
+};
+
+class TransactionLog {
+public:
+    struct Config {
+        std::string activePath = "transaction.db";
+        std::string dir = "txlog";
+        uint64_t maxSegmentBytes = 4 * 1024 * 1024;
+        bool rotateDaily = true;
+    };
+
+    TransactionLog();
+    explicit TransactionLog(Config config);
+
+    const Config &config() const { return cfg; }
+
+    // Appends one entry for the wallet, stamped with the current local time,
+    // and seals the active segment if it is due.
+    void append(int wallet_id, const std::string &entry);
+    // Appends a batch stamped with when, opening the file once per segment.
+    // Writers that run behind the operation pass the time it was applied.
+    void append(const std::vector<LogEntry> &entries, time_t when);
+
+    // Seals the active segment now. Returns false if it was empty or missing.
+    bool seal();
+
+    // Calls f for every line of the wallet stamped within [from, to], oldest
+    // first. Returns false if there is no log at all.
+    bool forEach(int wallet_id, const std::function<void(std::string_view)> &f,
+                 LogStamp from = 0, LogStamp to = UINT64_MAX);
+
+    // Up to size lines of the wallet stamped up to to, newest first, from the
+    // line before the cursor on. Reads the active file backwards in blocks and
+    // decompresses at most the sealed segments the page reaches, so a page
+    // costs about the same however long the history is.
+    HistoryPage page(int wallet_id, size_t size, LogCursor from = {}, LogStamp to = UINT64_MAX);
+
+    // Sealed segments, oldest first.
+    std::vector<SegmentInfo> segments();
+
+    // Reads a whole sealed segment back as text.
+    bool readSegment(const SegmentInfo &seg, std::string &out) const;
+
+    // Splits a log line into its stamp and wallet id.
+    static bool parseLine(std::string_view line, LogStamp &ts, int &wallet_id);
+    static LogStamp stampOf(time_t t);
+
+private:
+    // Appends may come from the I/O thread while a menu reads history.
+    mutable std::mutex lock;
+    Config cfg;
+    std::vector<SegmentInfo> manifest;
+    uint64_t manifestSize = UINT64_MAX;  // file size the cache was read at
+    LogStamp activeDay = 0;              // YYYYMMDD of the active segment, 0 = unknown
+    uint64_t lastActiveSize = 0;
+    // The sealed segment the last page ended in, kept for the next page.
+    SegmentInfo pageSegment;
+    std::string pageText;
+
+    std::string manifestPath() const;
+    std::string segmentPath(uint32_t seq) const;
+    void loadManifest();
+    bool sealLocked();
+    LogStamp readActiveDay();
+};
+
+// Process-wide log used by Wallet::log.
+TransactionLog &transactionLog();
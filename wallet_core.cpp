@@ -0,0 +1,499 @@
+#include "wallet_core.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
+#include "async_ops.h"
+#include "parallel.h"
+#include "text_loader.h"
+#include "transaction_log.h"
+
+using namespace std;
+
+void Wallet::log(const string &entry) {
+    Metrics::ScopedTimer timer(Metrics::WalletLog);
+    history.push_back(entry);
+    transactionLog().append(id, entry);
+}
+
+Database::Database() : users(strings.resource()), next_wallet_id(1) {
+    shards.open();
+    // Keys committed with the wallets but maybe not yet appended to
+    // idempotency.db; before any commit here replaces the note.
+    idempotency.recover(shards.note());
+    shardWallets.resize(shards.count());
+    changedWallets.assign(shards.count(), 0);
+    loadUsers();
+    loadWallets();
+    if (!wallets.count(0)) addWallet(0, 1000000);
+    if (shards.resharding()) {
+        // The shard count changed: write every shard in the new layout.
+        fill(changedWallets.begin(), changedWallets.end(), 1);
+        vector<ShardSet::File> files = serializeUsers();
+        for (ShardSet::File &f : serializeChangedWallets()) files.push_back(std::move(f));
+        shards.commit(std::move(files));
+    }
+    idempotency.load(Env::now());
+    limits.load();
+    // The one full read of topup_requests.db; from here on the totals
+    // follow requests and approvals.
+    long long pendingPoints = 0;
+    vector<TopUpRequest> pending = loadTopUpRequests();
+    for (const TopUpRequest &r : pending) pendingPoints += r.amount;
+    view.setPendingTopUps(pending.size(), pendingPoints);
+}
+
+Database::~Database() {
+    backupFiles();
+    // saveUsers();
+    // saveWallets();
+}
+
+User &Database::addUser(string_view uname, const string &pwd, string_view fname, bool admin, int wid, bool force) {
+    return putUser(uname, hash<string>()(pwd), fname, admin, wid, force);
+}
+
+User &Database::putUser(string_view uname, size_t pwd_hash, string_view fname, bool admin, int wid, bool force) {
+    string_view key = strings.intern(uname);
+    User &u = users[key];
+    u = User(key, "", strings.intern(fname), admin, wid, force);
+    u.password_hash = pwd_hash;
+    view.setUser(rowOf(u));
+    return u;
+}
+
+ProvisionResult Database::provisionUsers(const vector<NewUser> &batch, const string &credentialsPath, bool admin) {
+    Metrics::ScopedTimer timer(Metrics::ProvisionUsers);
+    ProvisionResult result;
+    loadUsers();
+    loadWallets();
+
+    vector<const NewUser *> accepted;
+    accepted.reserve(batch.size());
+    unordered_set<string_view> seen;
+    for (const NewUser &n : batch) {
+        if (n.username.empty() || n.full_name.empty()) {
+            result.rejected.push_back({n.line, "missing username or full name"});
+        } else if (users.count(n.username) || !seen.insert(n.username).second) {
+            result.rejected.push_back({n.line, "username " + n.username + " already exists"});
+        } else {
+            accepted.push_back(&n);
+        }
+    }
+    if (accepted.empty()) {
+        result.saved = true;
+        return result;
+    }
+
+    // Each block gets its own engine, seeded here in order, so the generated
+    // passwords do not depend on how the blocks land on threads.
+    constexpr size_t kBlock = 1024;
+    size_t blocks = (accepted.size() + kBlock - 1) / kBlock;
+    vector<uint32_t> seeds(blocks);
+    for (uint32_t &s : seeds) s = Env::rng()();
+    result.created.resize(accepted.size());
+    vector<size_t> hashes(accepted.size());
+    parallelFor(blocks, blocks > 1, [&](size_t b) {
+        mt19937 engine(seeds[b]);
+        for (size_t i = b * kBlock; i < min(accepted.size(), (b + 1) * kBlock); ++i) {
+            ProvisionedUser &p = result.created[i];
+            p.username = accepted[i]->username;
+            p.wallet_id = next_wallet_id + static_cast<int>(i);
+            p.generated = accepted[i]->password.empty();
+            p.password = p.generated ? OTPService::generateOTP(10, engine) : accepted[i]->password;
+            hashes[i] = hash<string>()(p.password);
+        }
+    });
+
+    // Accounts whose only password is lost would be unusable, so the
+    // credentials reach the disk first.
+    if (!writeCredentials(credentialsPath, result.created)) {
+        result.created.clear();
+        return result;
+    }
+    result.saved = true;
+
+    next_wallet_id += static_cast<int>(accepted.size());
+    users.reserve(users.size() + accepted.size());
+    {
+        auto batchLock = view.batch();
+        for (size_t i = 0; i < accepted.size(); ++i) {
+            const ProvisionedUser &p = result.created[i];
+            putUser(p.username, hashes[i], accepted[i]->full_name, admin, p.wallet_id, p.generated);
+            if (!admin) addWallet(p.wallet_id);
+        }
+    }
+
+    waitForWrites();
+    vector<ShardSet::File> files = serializeUsers();
+    for (ShardSet::File &f : serializeChangedWallets()) files.push_back(std::move(f));
+    shards.commit(std::move(files));
+    return result;
+}
+
+Wallet &Database::addWallet(int id, long long balance) {
+    Wallet &w = putWallet(id, balance);
+    changedWallets[shards.shardOf(id)] = 1;
+    return w;
+}
+
+// addWallet without marking the shard changed, for rows read from disk.
+Wallet &Database::putWallet(int id, long long balance) {
+    auto [it, added] = wallets.try_emplace(id);
+    if (added) shardWallets[shards.shardOf(id)].push_back(id);
+    Wallet &w = it->second;
+    w = Wallet(id);
+    w.balance = balance;
+    view.setBalance(id, balance);
+    return w;
+}
+
+vector<ShardSet::File> Database::serializeUsers() const {
+    vector<ostringstream> out(shards.count());
+    for (auto &p : users) {
+        const User &u = p.second;
+        out[shards.shardOf(u.wallet_id)] << u.username << ' ' << u.password_hash << ' ' << u.full_name << ' '
+                                         << u.is_admin << ' ' << u.wallet_id << ' ' << u.must_change_password
+                                         << '\n';
+    }
+    vector<ShardSet::File> files;
+    for (unsigned k = 0; k < out.size(); ++k) files.push_back({ShardSet::Users, k, out[k].str()});
+    return files;
+}
+
+vector<ShardSet::File> Database::serializeChangedWallets() {
+    vector<ShardSet::File> files;
+    for (unsigned k = 0; k < changedWallets.size(); ++k) {
+        if (!changedWallets[k]) continue;
+        changedWallets[k] = 0;
+        files.push_back({ShardSet::Wallets, k, serializeWallets(k)});
+    }
+    return files;
+}
+
+string Database::serializeWallets(unsigned shard) const {
+    string out;
+    out.reserve(shardWallets[shard].size() * 16);
+    char num[24];
+    for (int id : shardWallets[shard]) {
+        const Wallet &w = wallets.at(id);
+        out.append(num, to_chars(num, num + sizeof(num), w.id).ptr);
+        out.push_back(' ');
+        out.append(num, to_chars(num, num + sizeof(num), w.balance).ptr);
+        out.push_back('\n');
+    }
+    return out;
+}
+
+void Database::writeFile(const char *path, const string &content) {
+    ofstream ofs(path, ios::trunc);
+    ofs.write(content.data(), static_cast<streamsize>(content.size()));
+}
+
+void Database::writeLog(const vector<LogEntry> &log, time_t when) {
+    if (log.empty()) return;
+    Metrics::ScopedTimer timer(Metrics::WalletLog);
+    transactionLog().append(log, when);
+}
+
+string Database::serializeTopUpRequests(const vector<TopUpRequest> &pending) {
+    string out;
+    for (const auto &r : pending)
+        out += r.request_id + " " + to_string(r.wallet_id) + " " + to_string(r.amount) + " " +
+               to_string(r.timestamp) + "\n";
+    return out;
+}
+
+void Database::writeTopUpRequests(const vector<TopUpRequest> &pending) {
+    {
+        ofstream temp("topup_requests_temp.db");
+        temp << serializeTopUpRequests(pending);
+    }
+    remove("topup_requests.db");
+    rename("topup_requests_temp.db", "topup_requests.db");
+}
+
+void Database::saveUsers() {
+    Metrics::ScopedTimer timer(Metrics::SaveUsers);
+    waitForWrites();
+    shards.commit(serializeUsers());
+}
+
+void Database::saveWallets(const vector<IdempotencyRecord> &keys) {
+    Metrics::ScopedTimer timer(Metrics::SaveWallets);
+    waitForWrites();
+    shards.commit(serializeChangedWallets(), IdempotencyCache::serialize(keys));
+    idempotency.persist(keys);
+}
+
+void Database::loadWallets() {
+    Metrics::ScopedTimer timer(Metrics::LoadWallets);
+    waitForWrites();
+    // Shards are parsed on the reading threads and added here.
+    vector<vector<pair<int, long long>>> rows(shards.stored());
+    shards.read(ShardSet::Wallets, false, [&](unsigned k, string_view buf) {
+        rows[k].reserve(buf.size() / 8);
+        TextLoader::forEachWallet(buf, [&](int id, long long bal) { rows[k].push_back({id, bal}); });
+    });
+    auto batch = view.batch();
+    for (const auto &shard : rows)
+        for (auto [id, bal] : shard) putWallet(id, bal);
+}
+
+void Database::loadUsers() {
+    Metrics::ScopedTimer timer(Metrics::LoadUsers);
+    waitForWrites();
+    // Files are read in parallel but parsed one at a time, since users and
+    // strings are shared.
+    mutex parse;
+    shards.read(ShardSet::Users, false, [&](unsigned, string_view buf) {
+        lock_guard<mutex> guard(parse);
+        parseUsers(buf);
+    });
+}
+
+void Database::parseUsers(string_view buf) {
+    // Size the table once up front; a user line is rarely shorter than 32 bytes.
+    if (users.empty()) users.reserve(buf.size() * shards.stored() / 32 + 1);
+    TextLoader::forEachUser(buf, [this](string_view uname, size_t pwd_hash, string_view fname,
+                                        bool admin, int wid, bool force) {
+        // Existing records are updated in place so references handed out
+        // by login() stay valid across reloads; only new or changed
+        // strings are copied into the arena.
+        auto it = users.find(uname);
+        if (it == users.end()) {
+            string_view key = strings.intern(uname);
+            it = users.emplace(key, User()).first;
+            it->second.username = key;
+        }
+        User &u = it->second;
+        setFullName(u, fname);
+        u.is_admin = admin;
+        u.wallet_id = wid;
+        u.must_change_password = force;
+        u.password_hash = pwd_hash;
+        view.setUser(rowOf(u));
+        next_wallet_id = max(next_wallet_id, wid + 1);
+    });
+}
+
+void Database::credit(Wallet &w, long long amount, string entry, vector<LogEntry> &log) {
+    w.balance += amount;
+    view.setBalance(w.id, w.balance);
+    changedWallets[shards.shardOf(w.id)] = 1;
+    w.history.push_back(entry);
+    log.push_back({w.id, std::move(entry)});
+}
+
+bool Database::applyTransfer(int from, int to, long long amount, vector<LogEntry> &log) {
+    auto src = wallets.find(from);
+    auto dest = wallets.find(to);
+    if (src == wallets.end() || dest == wallets.end()) return false;
+    if (src->second.balance < amount) return false;
+    time_t now = Env::now();
+    if (limits.transfers.check(from, amount, now) != RateLimiter::Verdict::Allowed) return false;
+    limits.transfers.record(from, amount, now);
+    moveBetween(src->second, dest->second, amount, log);
+    return true;
+}
+
+bool Database::applyStandingOrder(int from, int to, long long amount, vector<LogEntry> &log) {
+    auto src = wallets.find(from);
+    auto dest = wallets.find(to);
+    if (src == wallets.end() || dest == wallets.end()) return false;
+    if (src->second.balance < amount) return false;
+    moveBetween(src->second, dest->second, amount, log);
+    return true;
+}
+
+void Database::moveBetween(Wallet &from, Wallet &to, long long amount, vector<LogEntry> &log) {
+    auto batch = view.batch();
+    credit(from, -amount, "Sent " + to_string(amount) + " to " + to_string(to.id), log);
+    credit(to, amount, "Received " + to_string(amount) + " from " + to_string(from.id), log);
+}
+
+bool Database::applyTopUp(int wallet_id, long long amount, vector<LogEntry> &log) {
+    if (wallet_id == 0 || !wallets.count(wallet_id)) return false;
+    Wallet &central = wallets.at(0);
+    if (central.balance < amount) return false;
+
+    auto batch = view.batch();
+    credit(central, -amount, "Debited " + to_string(amount) + " to wallet " + to_string(wallet_id), log);
+    credit(wallets.at(wallet_id), amount, "Received " + to_string(amount) + " from central", log);
+    return true;
+}
+
+TopUpApproval Database::applyTopUpApproval(const vector<TopUpRequest> &all,
+                                           const function<bool(const TopUpRequest &)> &select,
+                                           vector<LogEntry> &log, vector<TopUpRequest> &pending,
+                                           vector<IdempotencyRecord> &keys) {
+    Wallet &central = wallets.at(0);
+    TopUpApproval result;
+    time_t now = Env::now();
+
+    // Requests are checked against the balance left after the ones already
+    // approved in this pass, so a batch can never overdraw the central wallet.
+    long long available = central.balance;
+    long long pendingPoints = 0;
+    for (const auto &r : all) {
+        if (select(r)) {
+            // A request id is approved at most once, even if the file holds
+            // it twice or the same request comes back after approval.
+            if (idempotency.contains(requestKey(r.request_id), now)) {
+                result.duplicates.push_back(r);
+                continue;
+            }
+            if (!wallets.count(r.wallet_id)) {
+                result.missingWallet.push_back(r);
+            } else if (available < r.amount) {
+                result.insufficientFunds.push_back(r);
+            } else {
+                available -= r.amount;
+                result.approved.push_back(r);
+                keys.push_back(idempotency.remember(requestKey(r.request_id), topUpFingerprint(r.wallet_id, r.amount), now));
+                continue;
+            }
+        }
+        pending.push_back(r);
+        pendingPoints += r.amount;
+    }
+
+    auto batch = view.batch();
+    // This pass has every request in hand, so the pending totals are set
+    // outright rather than adjusted.
+    view.setPendingTopUps(pending.size(), pendingPoints);
+    for (const auto &r : result.approved) {
+        credit(central, -r.amount, "Debited " + to_string(r.amount) + " to wallet " + to_string(r.wallet_id), log);
+        credit(wallets.at(r.wallet_id), r.amount, "Received " + to_string(r.amount) + " from central", log);
+    }
+    return result;
+}
+
+uint64_t Database::transferFingerprint(int from, int to, long long amount) {
+    return IdempotencyCache::fingerprint("transfer " + to_string(from) + " " + to_string(to) + " " + to_string(amount));
+}
+
+uint64_t Database::topUpFingerprint(int wallet_id, long long amount) {
+    return IdempotencyCache::fingerprint("topup " + to_string(wallet_id) + " " + to_string(amount));
+}
+
+bool Database::replayed(const string &key, uint64_t fingerprint, bool &result) {
+    if (key.empty()) return false;
+    if (!IdempotencyCache::validKey(key)) {
+        result = false;
+        return true;
+    }
+    switch (idempotency.check(clientKey(key), fingerprint, Env::now())) {
+    case IdempotencyCache::Seen::No: return false;
+    case IdempotencyCache::Seen::Same: result = true; return true;
+    case IdempotencyCache::Seen::Different: result = false; return true;
+    }
+    return false;
+}
+
+bool Database::transfer(int from, int to, long long amount, const string &key) {
+    Metrics::ScopedTimer timer(Metrics::Transfer);
+    uint64_t fp = transferFingerprint(from, to, amount);
+    bool result;
+    if (replayed(key, fp, result)) return result;
+    vector<LogEntry> log;
+    if (!applyTransfer(from, to, amount, log)) return false;
+    waitForWrites();
+    writeLog(log, Env::now());
+    vector<IdempotencyRecord> keys;
+    if (!key.empty()) keys.push_back(idempotency.remember(clientKey(key), fp, Env::now()));
+    saveWallets(keys);
+    return true;
+}
+
+bool Database::topUp(int wallet_id, long long amount, const string &key) {
+    Metrics::ScopedTimer timer(Metrics::TopUp);
+    uint64_t fp = topUpFingerprint(wallet_id, amount);
+    bool result;
+    if (replayed(key, fp, result)) return result;
+    vector<LogEntry> log;
+    if (!applyTopUp(wallet_id, amount, log)) return false;
+    waitForWrites();
+    writeLog(log, Env::now());
+    vector<IdempotencyRecord> keys;
+    if (!key.empty()) keys.push_back(idempotency.remember(clientKey(key), fp, Env::now()));
+    saveWallets(keys);
+    return true;
+}
+
+bool Database::topUpRequestExists(const string &request_id) {
+    if (idempotency.contains(requestKey(request_id), Env::now())) return true;
+    for (const auto &r : loadTopUpRequests())
+        if (r.request_id == request_id) return true;
+    return false;
+}
+
+bool Database::requestTopUp(const string &request_id, int wallet_id, long long amount, time_t when) {
+    if (!IdempotencyCache::validKey(request_id) || topUpRequestExists(request_id)) return false;
+    if (limits.topUpRequests.check(wallet_id, amount, when) != RateLimiter::Verdict::Allowed) return false;
+    ofstream req("topup_requests.db", ios::app);
+    if (!req) return false;
+    req << request_id << " " << wallet_id << " " << amount << " " << when << "\n";
+    limits.topUpRequests.record(wallet_id, amount, when);
+    view.addPendingTopUp(amount);
+    return true;
+}
+
+vector<TopUpRequest> Database::loadTopUpRequests() {
+    waitForWrites();
+    vector<TopUpRequest> requests;
+    string buf;
+    if (TextLoader::readFile("topup_requests.db", buf)) {
+        TextLoader::forEachTopUp(buf, [&](string_view request_id, int wallet_id, long long amt, time_t t) {
+            requests.push_back({string(request_id), wallet_id, amt, t});
+        });
+    }
+    return requests;
+}
+
+TopUpApproval Database::approveTopUps(const function<bool(const TopUpRequest &)> &select) {
+    Metrics::ScopedTimer timer(Metrics::ApproveTopUps);
+    vector<TopUpRequest> all = loadTopUpRequests();
+    loadWallets();
+    vector<LogEntry> log;
+    vector<TopUpRequest> pending;
+    vector<IdempotencyRecord> keys;
+    TopUpApproval result = applyTopUpApproval(all, select, log, pending, keys);
+    writeLog(log, Env::now());
+    saveWallets(keys);
+    writeTopUpRequests(pending);
+    return result;
+}
+
+bool Database::forEachTransaction(int wallet_id, const function<void(string_view)> &f, LogStamp to) {
+    waitForWrites();
+    return transactionLog().forEach(wallet_id, f, 0, to);
+}
+
+HistoryPage Database::historyPage(int wallet_id, size_t size, LogCursor from, LogStamp to) {
+    waitForWrites();
+    return transactionLog().page(wallet_id, size, from, to);
+}
+
+bool Database::exportHistory(int wallet_id, const string &path, ExportFormat format, uint64_t &lines, LogStamp to) {
+    waitForWrites();
+    return ::exportHistory(transactionLog(), wallet_id, path, format, lines, to);
+}
+
+void Database::waitForWrites() {
+    if (io) io->drain();
+}
+
+void Database::backupFiles() {
+    time_t now = Env::now();
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", localtime(&now));
+    string ts(buf);
+    // rename("users.db", ("users.db." + ts).c_str());
+    // rename("wallets.db", ("wallets.db." + ts).c_str());
+    shards.backup();
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+// Core data model and operations of the wallet points system: users, wallets,
+// the OTP service and the file-backed Database. Nothing in here prompts or
+// prints, so the same code is shared by the interactive menus in
+// wallet_final.cpp and by the benchmarks under bench/.
+
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "env.h"
+#include "history_export.h"
+#include "idempotency.h"
+#include "metrics.h"
+#include "provision.h"
+#include "rate_limit.h"
+#include "shard.h"
+#include "snapshot.h"
+
+// Simple OTP service with alphanumeric support
+class OTPService {
+public:
+    static std::string generateOTP(size_t length = 8) {
+        Metrics::ScopedTimer timer(Metrics::OtpGenerate);
+        return generateOTP(length, Env::rng());
+    }
+    // From the caller's engine, for threads other than the menus'. Untimed:
+    // those threads, such as parallelFor's, come and go, and each would keep
+    // a metrics slot for good.
+    static std::string generateOTP(size_t length, std::mt19937 &engine) {
+        static const char charset[] =
+            "0123456789"
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+            "abcdefghijklmnopqrstuvwxyz";
+        // Rejection sampling on the raw engine output rather than a
+        // std::uniform_int_distribution, whose mapping is left to the
+        // standard library: mt19937 itself is fully specified, so a seed
+        // gives the same OTPs with any compiler.
+        constexpr uint32_t kChars = sizeof(charset) - 1;
+        constexpr uint32_t kLimit = UINT32_MAX - UINT32_MAX % kChars;
+        std::string otp;
+        for (size_t i = 0; i < length; ++i) {
+            uint32_t v;
+            do {
+                v = static_cast<uint32_t>(engine());
+            } while (v >= kLimit);
+            otp += charset[v % kChars];
+        }
+        return otp;
+    }
+    static bool verifyOTP(const std::string &sent, const std::string &input) {
+        return sent == input;
+    }
+};
+
+// Interned string storage for user records. Strings are copied into large
+// contiguous blocks and handed out as string_views that stay valid until the
+// arena is destroyed; nothing is freed individually. The same blocks also back
+// the user map nodes, so loading a user file costs a few bulk allocations.
+class StringArena {
+public:
+    StringArena() : pool(64 * 1024) {}
+    StringArena(const StringArena &) = delete;
+    StringArena &operator=(const StringArena &) = delete;
+
+    std::string_view intern(std::string_view s) {
+        if (s.empty()) return std::string_view();
+        char *p = static_cast<char *>(pool.allocate(s.size(), 1));
+        memcpy(p, s.data(), s.size());
+        return std::string_view(p, s.size());
+    }
+    std::pmr::memory_resource *resource() { return &pool; }
+
+private:
+    std::pmr::monotonic_buffer_resource pool;
+};
+
+// User account class. username and full_name point into Database::strings.
+class User {
+public:
+    std::string_view username;
+    size_t password_hash;
+    std::string_view full_name;
+    bool is_admin;
+    int wallet_id;
+    bool must_change_password;
+
+    User() : password_hash(0), is_admin(false), wallet_id(0), must_change_password(false) {}
+    User(std::string_view u, const std::string &pwd, std::string_view name, bool admin, int wid, bool force_change = false)
+        : username(u), full_name(name), is_admin(admin), wallet_id(wid), must_change_password(force_change) {
+        password_hash = std::hash<std::string>()(pwd);
+    }
+
+    bool checkPassword(const std::string &pwd) const {
+        return std::hash<std::string>()(pwd) == password_hash;
+    }
+    void setPassword(const std::string &pwd) {
+        password_hash = std::hash<std::string>()(pwd);
+    }
+};
+
+// Wallet class for points and transaction logging
+class Wallet {
+public:
+    int id;
+    long long balance;
+    std::vector<std::string> history;
+
+    Wallet() : id(0), balance(0) {}
+    Wallet(int _id) : id(_id), balance(0) {}
+
+    void log(const std::string &entry);
+};
+
+// One line of topup_requests.db
+struct TopUpRequest {
+    std::string request_id;
+    int wallet_id;
+    long long amount;
+    time_t timestamp;
+};
+
+// Outcome of Database::approveTopUps, split by what happened to each request.
+struct TopUpApproval {
+    std::vector<TopUpRequest> approved;
+    std::vector<TopUpRequest> missingWallet;     // kept pending
+    std::vector<TopUpRequest> insufficientFunds; // kept pending
+    std::vector<TopUpRequest> duplicates;        // id already approved, dropped
+};
+
+class IoThread;
+
+// Database with users and wallets
+class Database {
+public:
+    StringArena strings;
+    std::pmr::unordered_map<std::string_view, User> users;  // keyed on the interned username
+    std::unordered_map<int, Wallet> wallets;
+    int next_wallet_id;
+    IdempotencyCache idempotency;  // transfer/top-up keys and approved request ids
+    WalletLimits limits;           // velocity limits on transfers and top-up requests
+    ShardSet shards;               // users.db/wallets.db split by wallet id, see shard.h
+
+    Database();
+    ~Database();
+
+    User &addUser(std::string_view uname, const std::string &pwd, std::string_view fname, bool admin, int wid, bool force = false);
+    void setFullName(User &u, std::string_view fname) {
+        if (u.full_name == fname) return;
+        u.full_name = strings.intern(fname);
+        view.setUser(rowOf(u));
+    }
+    Wallet &addWallet(int id, long long balance = 0);
+    // Creates users, each with a new wallet unless admin, from one load of
+    // the files and in one commit. Passwords are generated and hashed on all
+    // cores; wallet ids come in one block from next_wallet_id, in input
+    // order. Taken usernames and repeats within the batch are rejected. The
+    // generated passwords go to credentialsPath before anything is created;
+    // if that file cannot be written nothing is, and saved stays false.
+    ProvisionResult provisionUsers(const std::vector<NewUser> &batch, const std::string &credentialsPath,
+                                   bool admin = false);
+
+    // Consistent view of balances and users as of now, for reports that
+    // should not hold up transfers. Cheap to take; see snapshot.h.
+    Snapshot snapshot() { return view.snapshot(); }
+
+    // Saves write every user shard but only the wallet shards changed since
+    // the last save; loads read only the shards changed on disk since they
+    // were last read or written.
+    void saveUsers();
+    // keys are the idempotency records of the changes being saved; they are
+    // committed together with the wallet shards.
+    void saveWallets(const std::vector<IdempotencyRecord> &keys = {});
+    void loadWallets();
+    void loadUsers();
+
+    // While an I/O thread is attached, every direct file access first waits
+    // for the writes it has queued, so reads never see stale files and
+    // synchronous saves never get overwritten by older queued ones.
+    void setIoThread(IoThread *t) { io = t; }
+
+    // The in-memory halves of the operations below: they validate, move the
+    // points, record wallet history and return the log lines to persist.
+    // Transfers count against the source wallet's limits.
+    bool applyTransfer(int from, int to, long long amount, std::vector<LogEntry> &log);
+    bool applyTopUp(int wallet_id, long long amount, std::vector<LogEntry> &log);
+    // A transfer made by the system, such as a standing order: same checks
+    // and log lines as applyTransfer, but outside the user velocity limits.
+    bool applyStandingOrder(int from, int to, long long amount, std::vector<LogEntry> &log);
+    // pending receives the requests that stay in topup_requests.db, keys the
+    // ids of the approved ones, to be persisted after the log.
+    TopUpApproval applyTopUpApproval(const std::vector<TopUpRequest> &all,
+                                     const std::function<bool(const TopUpRequest &)> &select,
+                                     std::vector<LogEntry> &log, std::vector<TopUpRequest> &pending,
+                                     std::vector<IdempotencyRecord> &keys);
+
+    // Idempotency check for an operation carrying a client key. Returns true
+    // with the answer in result when the call must not be applied: a retry of
+    // the remembered operation (result true), or a malformed key or one
+    // already used for something else (result false). An empty key never
+    // matches.
+    bool replayed(const std::string &key, uint64_t fingerprint, bool &result);
+    // Client keys and approved request ids share the idempotency cache, each
+    // under its own prefix, so that neither can stand in for the other.
+    static std::string clientKey(const std::string &key) { return "cli:" + key; }
+    static std::string requestKey(const std::string &request_id) { return "req:" + request_id; }
+    static uint64_t transferFingerprint(int from, int to, long long amount);
+    static uint64_t topUpFingerprint(int wallet_id, long long amount);
+
+    // One file per shard, for ShardSet::commit.
+    std::vector<ShardSet::File> serializeUsers() const;
+    // The wallet shards changed since the last call, which are then clean.
+    std::vector<ShardSet::File> serializeChangedWallets();
+    std::string serializeWallets(unsigned shard) const;
+    static void writeFile(const char *path, const std::string &content);
+    static void writeLog(const std::vector<LogEntry> &log, time_t when);
+    static std::string serializeTopUpRequests(const std::vector<TopUpRequest> &pending);
+    static void writeTopUpRequests(const std::vector<TopUpRequest> &pending);
+
+    // Moves amount from one wallet to another, logs both sides and saves.
+    // Returns false without changing anything if either wallet is missing or
+    // the source cannot cover the amount. With a key, a retry of a transfer
+    // that went through is a no-op that returns true again.
+    bool transfer(int from, int to, long long amount, const std::string &key = "");
+    // Credits a user wallet from the central wallet (id 0).
+    bool topUp(int wallet_id, long long amount, const std::string &key = "");
+
+    // Appends a request to topup_requests.db. Fails if request_id is pending
+    // or was approved within the idempotency window, or if the wallet is over
+    // its top-up request limits.
+    bool requestTopUp(const std::string &request_id, int wallet_id, long long amount, time_t when);
+    bool topUpRequestExists(const std::string &request_id);
+    std::vector<TopUpRequest> loadTopUpRequests();
+    // Approves every pending request matching select, as far as the central
+    // balance allows, and rewrites topup_requests.db with the rest.
+    TopUpApproval approveTopUps(const std::function<bool(const TopUpRequest &)> &select);
+
+    // Calls f for every transaction log line that belongs to the wallet,
+    // oldest first, across sealed segments and transaction.db, up to the
+    // stamp to (pass Snapshot::asOf() to match a snapshot).
+    // Returns false if there is no transaction log at all.
+    bool forEachTransaction(int wallet_id, const std::function<void(std::string_view)> &f,
+                            LogStamp to = UINT64_MAX);
+    // A page of the wallet's history, newest first; see TransactionLog::page.
+    HistoryPage historyPage(int wallet_id, size_t size, LogCursor from = {}, LogStamp to = UINT64_MAX);
+    // Writes the wallet's history up to the stamp to to path; see
+    // history_export.h.
+    bool exportHistory(int wallet_id, const std::string &path, ExportFormat format, uint64_t &lines,
+                       LogStamp to = UINT64_MAX);
+
+private:
+    IoThread *io = nullptr;
+    SnapshotStore view;   // follows every change to balances and users
+    std::vector<std::vector<int>> shardWallets;  // wallet ids by shard, in insertion order
+    std::vector<char> changedWallets;            // by shard, since the last save
+
+    static UserRow rowOf(const User &u) { return {u.username, u.full_name, u.is_admin, u.wallet_id}; }
+    Wallet &putWallet(int id, long long balance);
+    User &putUser(std::string_view uname, size_t pwd_hash, std::string_view fname, bool admin, int wid, bool force);
+    void parseUsers(std::string_view buf);
+    void credit(Wallet &w, long long amount, std::string entry, std::vector<LogEntry> &log);
+    void moveBetween(Wallet &from, Wallet &to, long long amount, std::vector<LogEntry> &log);
+    void waitForWrites();
+    void backupFiles();
+};
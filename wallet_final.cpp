@@ -4,11 +4,15 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <ctime>
-#include <random>
-#include <functional>
 #include <limits>
 #include <iomanip>
+#include "text_loader.h"
+#include "wallet_core.h"
+#include "async_ops.h"
 
 using namespace std;
 
@@ -85,153 +89,16 @@ struct PendingUpdate {
     string otp;
 };
 
-// Simple OTP service with alphanumeric support
-class OTPService {
-public:
-    static string generateOTP(size_t length = 8) {
-        static const char charset[] =
-            "0123456789"
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-            "abcdefghijklmnopqrstuvwxyz";
-        static mt19937 rng(static_cast<unsigned>(time(nullptr)));
-        static uniform_int_distribution<> dist(0, sizeof(charset) - 2);
-        string otp;
-        for (size_t i = 0; i < length; ++i) {
-            otp += charset[dist(rng)];
-        }
-        return otp;
-    }
-    static bool verifyOTP(const string &sent, const string &input) {
-        return sent == input;
-    }
-};
-
-// User account class
-class User {
-public:
-    string username;
-    size_t password_hash;
-    string full_name;
-    bool is_admin;
-    int wallet_id;
-    bool must_change_password;
-
-    User() : is_admin(false), wallet_id(0), must_change_password(false) {}
-    User(const string &u, const string &pwd, const string &name, bool admin, int wid, bool force_change = false)
-        : username(u), full_name(name), is_admin(admin), wallet_id(wid), must_change_password(force_change) {
-        password_hash = hash<string>()(pwd);
-    }
-
-    bool checkPassword(const string &pwd) const {
-        return hash<string>()(pwd) == password_hash;
-    }
-    void setPassword(const string &pwd) {
-        password_hash = hash<string>()(pwd);
-    }
-};
-
-// Wallet class for points and transaction logging
-class Wallet {
-public:
-    int id;
-    long long balance;
-    vector<string> history;
-
-    Wallet() : id(0), balance(0) {}
-    Wallet(int _id) : id(_id), balance(0) {}
-
-    void log(const string &entry) {
-        history.push_back(entry);
-        ofstream logf("transaction.db", ios::app);
-        if (logf) {
-            time_t now = time(nullptr);
-            char buf[64];
-            strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
-            logf << "[" << buf << "] Wallet " << id << ": " << entry << '\n';
-        }
-    }
-};
-
-// Database with users and wallets
-class Database {
-public:
-    unordered_map<string, User> users;
-    unordered_map<int, Wallet> wallets;
-    int next_wallet_id;
-
-    void saveUsers() {
-        ofstream ofs("users.db", ios::trunc);
-        for (auto &p : users) {
-            User &u = p.second;
-            ofs << u.username << ' ' << u.password_hash << ' ' << u.full_name
-                << ' ' << u.is_admin << ' ' << u.wallet_id << ' ' << u.must_change_password << '\n';
-        }
-    }
-    void saveWallets() {
-        ofstream ofs("wallets.db", ios::trunc);
-        for (auto &p : wallets) {
-            Wallet &w = p.second;
-            ofs << w.id << ' ' << w.balance << '\n';
-        }
-    }
-    void loadWallets() {
-        ifstream ifs("wallets.db");
-        if (!ifs) return;
-        int id;
-        long long bal;
-        while (ifs >> id >> bal) {
-            wallets[id] = Wallet(id);
-            wallets[id].balance = bal;
-        }
-    }
-    void loadUsers() {
-        ifstream ifs("users.db");
-        if (!ifs) return;
-        string uname, fname;
-        size_t pwd_hash;
-        bool admin, force;
-        int wid;
-        while (ifs >> uname >> pwd_hash >> fname >> admin >> wid >> force) {
-            User u;
-            u.username = uname;
-            u.full_name = fname;
-            u.is_admin = admin;
-            u.wallet_id = wid;
-            u.must_change_password = force;
-            u.password_hash = pwd_hash;
-            users[uname] = u;
-            next_wallet_id = max(next_wallet_id, wid + 1);
-        }
-    }
-
-    Database() : next_wallet_id(1) {
-        loadUsers();
-        loadWallets();
-        if (!wallets.count(0)) {
-            wallets[0] = Wallet(0);
-            wallets[0].balance = 1000000;
-        }
-    }
-    ~Database() {
-        backupFiles();
-        // saveUsers();
-        // saveWallets();
-    }
-
-private:
-    void backupFiles() {
-        time_t now = time(nullptr);
-        char buf[32];
-        strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", localtime(&now));
-        string ts(buf);
-        // rename("users.db", ("users.db." + ts).c_str());
-        // rename("wallets.db", ("wallets.db." + ts).c_str());
-        rename("users.db", "users_backup.db");
-        rename("wallets.db", "wallets_backup.db");
-    }
-};
-
 Database db;
+// Transfers, top-ups, approvals and profile updates run through here; their
+// file writes are persisted in the background.
+Pipeline pipeline(db);
+// Standing orders, loaded in main() and run whenever a menu comes around.
+Scheduler scheduler;
+
+void runScheduledTransfers() {
+    pipeline.runSchedule(scheduler, Env::now()).get();
+}
 
 // Authentication
 User* login() {
@@ -258,7 +125,7 @@ User* login() {
             printSuccess("Password updated. Please log in again.");
             return nullptr;
         }
-        printSuccess("Login successful! Welcome, " + user->full_name + "!");
+        printSuccess("Login successful! Welcome, " + string(user->full_name) + "!");
         return user;
     }
     printError("Invalid credentials.");
@@ -294,9 +161,9 @@ void registerUser(bool asAdmin = false) {
     string name;
     getline(cin, name);
     int wid = db.next_wallet_id++;
-    db.users[u] = User(u, pwd, name, asAdmin, wid, forceChange);
+    db.addUser(u, pwd, name, asAdmin, wid, forceChange);
     if (!asAdmin) {
-        db.wallets[wid] = Wallet(wid);
+        db.addWallet(wid);
         printSuccess("User '" + u + "' created with wallet ID " + to_string(wid) + ".");
     }
 
@@ -353,8 +220,7 @@ void updatePersonalInfo(User &user) {
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
     string name;
     getline(cin, name);
-    user.full_name = name;
-    db.saveUsers();
+    pipeline.updateProfile(string(user.username), name).get();
     printSuccess("Personal information updated successfully.");
     
     cout << endl;
@@ -363,6 +229,55 @@ void updatePersonalInfo(User &user) {
     cin.get();
 }
 
+// Pages through a wallet's history up to asOf, newest first, and offers an
+// export of the whole of it.
+void showHistory(int wallet_id, LogStamp asOf) {
+    const size_t kPageSize = 20;
+    LogCursor cursor;
+    size_t shown = 0;
+    while (true) {
+        HistoryPage page = db.historyPage(wallet_id, kPageSize, cursor, asOf);
+        for (const string &line : page.lines) {
+            shown++;
+            cout << Colors::BRIGHT_CYAN << shown << "." << Colors::RESET << " " << line << endl;
+        }
+        if (shown == 0) {
+            printInfo("No transaction history found.");
+        }
+        cursor = page.next;
+
+        cout << endl;
+        cout << Colors::BRIGHT_CYAN;
+        if (page.more) cout << "1. Older transactions\n";
+        cout << "2. Export to CSV\n";
+        cout << "3. Export to binary\n";
+        cout << "4. Back\n";
+        cout << "Choose: " << Colors::RESET;
+        int choice;
+        cin >> choice;
+        if (cin.fail()) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            return;
+        }
+        if (choice == 1 && page.more) continue;
+        if (choice != 2 && choice != 3) return;
+
+        ExportFormat format = choice == 2 ? ExportFormat::Csv : ExportFormat::Binary;
+        string path = "wallet_" + to_string(wallet_id) + "_history." + exportExtension(format);
+        uint64_t lines = 0;
+        if (db.exportHistory(wallet_id, path, format, lines, asOf)) {
+            printSuccess("Exported " + to_string(lines) + " transactions to " + path + ".");
+        } else {
+            printError("Could not write " + path + ".");
+        }
+        cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        cin.get();
+        return;
+    }
+}
+
 // View own wallet
 void viewWallet(const User &user) {
     clearScreen();
@@ -370,38 +285,17 @@ void viewWallet(const User &user) {
     cout << endl;
     
     db.loadWallets();
-    const Wallet &w = db.wallets.at(user.wallet_id);
+    // Balance and history from the same point in time.
+    Snapshot snap = db.snapshot();
+    long long balance = 0;
+    snap.balance(user.wallet_id, balance);
     
-    cout << Colors::BRIGHT_CYAN << "Wallet ID: " << Colors::RESET << w.id << endl;
-    cout << Colors::BRIGHT_GREEN << "Balance: " << Colors::RESET << w.balance << " points" << endl;
+    cout << Colors::BRIGHT_CYAN << "Wallet ID: " << Colors::RESET << user.wallet_id << endl;
+    cout << Colors::BRIGHT_GREEN << "Balance: " << Colors::RESET << balance << " points" << endl;
     cout << endl;
     
-    printSubHeader("TRANSACTION HISTORY");
-    
-    // Now read and filter transaction.db for this wallet
-    ifstream logf("transaction.db");
-    if (logf) {
-        string line;
-        int count = 0;
-        while (getline(logf, line)) {
-            // Only show lines matching "Wallet <id>:"
-            string match = "Wallet " + to_string(w.id) + ":";
-            if (line.find(match) != string::npos) {
-                count++;
-                cout << Colors::BRIGHT_CYAN << count << "." << Colors::RESET << " " << line << endl;
-            }
-        }
-        if (count == 0) {
-            printInfo("No transaction history found.");
-        }
-    } else {
-        printInfo("No transaction history available.");
-    }
-
-    cout << endl;
-    cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    cin.get();
+    printSubHeader("TRANSACTION HISTORY (NEWEST FIRST)");
+    showHistory(user.wallet_id, snap.asOf());
 }
 
 // Admin: view central wallet
@@ -415,13 +309,50 @@ void viewCentralWallet(const User &user) {
     printHeader("CENTRAL WALLET");
     cout << endl;
     
-    const Wallet &w = db.wallets.at(0);
-    cout << Colors::BRIGHT_GREEN << "Central Wallet Balance: " << Colors::RESET << w.balance << " points" << endl;
+    // Totals are kept up to date by every change, so this costs the same
+    // however many wallets there are.
+    Snapshot snap = db.snapshot();
+    BalanceTotals totals = snap.totals();
+    cout << Colors::BRIGHT_GREEN << "Central Wallet Balance: " << Colors::RESET << totals.central << " points" << endl;
+    cout << Colors::BRIGHT_CYAN << "Outstanding User Points: " << Colors::RESET << totals.userPoints << " points" << endl;
+    cout << Colors::BRIGHT_CYAN << "Active Wallets: " << Colors::RESET << totals.activeWallets << " of "
+         << totals.userWallets << endl;
+    cout << Colors::BRIGHT_CYAN << "Pending Top-ups: " << Colors::RESET << totals.pendingRequests << " requests, "
+         << totals.pendingPoints << " points" << endl;
     cout << endl;
-    
-    cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    cin.get();
+
+    printSubHeader("TOP BALANCES");
+    int rank = 0;
+    for (auto [wallet_id, balance] : snap.topBalances(10)) {
+        cout << Colors::BRIGHT_CYAN << ++rank << "." << Colors::RESET << " Wallet " << wallet_id << ": " << balance
+             << " points" << endl;
+    }
+    if (rank == 0) printInfo("No user wallets yet.");
+    cout << endl;
+
+    printSubHeader("TRANSACTION HISTORY (NEWEST FIRST)");
+    showHistory(0, snap.asOf());
+}
+
+// Optional idempotency key for an operation that moves points. Scripts that
+// retry on timeout send the same key again; "-" means none.
+// Returns false if the operation should not go ahead.
+bool readRequestKey(string &key) {
+    cout << Colors::BRIGHT_CYAN << "Request key (- for none): " << Colors::RESET;
+    cin >> key;
+    if (key == "-") {
+        key.clear();
+        return true;
+    }
+    if (!IdempotencyCache::validKey(key)) {
+        printError("Invalid request key.");
+        return false;
+    }
+    if (db.idempotency.contains(Database::clientKey(key), Env::now())) {
+        printInfo("Request " + key + " was already processed.");
+        return false;
+    }
+    return true;
 }
 
 // Admin: top-up user wallet
@@ -451,20 +382,15 @@ void topUpWallet(const User &user) {
     cout << Colors::BRIGHT_CYAN << "Amount to top-up: " << Colors::RESET;
     long long amt;
     cin >> amt;
-    if (central.balance < amt) {
-        printError("Insufficient central balance.");
+    string key;
+    if (!readRequestKey(key)) return;
+    if (!pipeline.topUp(wid, amt, key).get()) {
+        printError("Insufficient central balance or request key already used.");
         return;
     }
     
-    central.balance -= amt;
-    Wallet &target = db.wallets.at(wid);
-    target.balance += amt;
-    central.log("Debited " + to_string(amt) + " to wallet " + to_string(wid));
-    target.log("Received " + to_string(amt) + " from central");
-    
     printSuccess("Top-up successful!");
     cout << Colors::BRIGHT_GREEN << "Remaining central balance: " << Colors::RESET << central.balance << " points" << endl;
-    db.saveWallets();
     
     cout << endl;
     cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
@@ -494,6 +420,13 @@ void transferPoints(User &user) {
     cout << Colors::BRIGHT_CYAN << "Amount: " << Colors::RESET;
     long long amount;
     cin >> amount;
+    string key;
+    if (!readRequestKey(key)) return;
+    RateLimiter::Verdict verdict = db.limits.transfers.check(src.id, amount, Env::now());
+    if (verdict != RateLimiter::Verdict::Allowed) {
+        printError(describe(verdict));
+        return;
+    }
     
     printInfo("Sending OTP for transaction...");
     string code = OTPService::generateOTP(6);
@@ -507,18 +440,11 @@ void transferPoints(User &user) {
         return;
     }
     
-    if (src.balance < amount) {
-        printError("Insufficient balance.");
+    if (!pipeline.transfer(src.id, dest_id, amount, key).get()) {
+        printError("Insufficient balance, transfer limit reached or request key already used.");
         return;
     }
     
-    Wallet &dest = db.wallets.at(dest_id);
-    src.balance -= amount;
-    dest.balance += amount;
-    src.log("Sent " + to_string(amount) + " to " + to_string(dest_id));
-    dest.log("Received " + to_string(amount) + " from " + to_string(src.id));
-    db.saveWallets();
-    
     printSuccess("Transfer completed successfully!");
     cout << Colors::BRIGHT_GREEN << "New balance: " << Colors::RESET << src.balance << " points" << endl;
     
@@ -551,15 +477,20 @@ void userRequestTopUp(User &user) {
         return;
     }
 
+    RateLimiter::Verdict verdict = db.limits.topUpRequests.check(user.wallet_id, amt, Env::now());
+    if (verdict != RateLimiter::Verdict::Allowed) {
+        printError(describe(verdict));
+        return;
+    }
+
     // Generate a unique request ID
     string requestID;
-    requestID = OTPService::generateOTP(8);
+    do {
+        requestID = OTPService::generateOTP(8);
+    } while (db.topUpRequestExists(requestID));
 
     // Simulate saving request to "top-up requests database"
-    ofstream req("topup_requests.db", ios::app);
-    if (req) {
-        time_t now = time(nullptr);
-        req << requestID << " " << user.wallet_id << " " << amt << " " << now << "\n";
+    if (db.requestTopUp(requestID, user.wallet_id, amt, Env::now())) {
         printSuccess("Top-up request submitted successfully!");
         cout << Colors::BRIGHT_CYAN << "Request ID: " << Colors::RESET << requestID << endl;
         cout << Colors::BRIGHT_CYAN << "Amount: " << Colors::RESET << amt << " points" << endl;
@@ -578,30 +509,15 @@ void adminApproveTopUps() {
     clearScreen();
     printHeader("APPROVE TOP-UP REQUESTS");
     cout << endl;
-    
-    struct Request {
-        string request_id;
-        int wallet_id;
-        long long amount;
-        time_t timestamp;
-    };
-
-    vector<Request> allRequests;
 
+    BalanceTotals totals = db.snapshot().totals();
+    cout << Colors::BRIGHT_CYAN << "Central Wallet Balance: " << Colors::RESET << totals.central << " points" << endl;
+    cout << Colors::BRIGHT_CYAN << "Pending Top-ups: " << Colors::RESET << totals.pendingRequests << " requests, "
+         << totals.pendingPoints << " points" << endl;
+    cout << endl;
+    
     // Load all requests
-    ifstream req("topup_requests.db");
-    string line;
-    while (getline(req, line)) {
-        istringstream iss(line);
-        string request_id;
-        int wallet_id;
-        long long amt;
-        time_t t;
-        if (iss >> request_id >> wallet_id >> amt >> t) {
-            allRequests.push_back({request_id, wallet_id, amt, t});
-        }
-    }
-    req.close();
+    vector<TopUpRequest> allRequests = db.loadTopUpRequests();
 
     if (allRequests.empty()) {
         printInfo("No pending top-up requests found.");
@@ -645,55 +561,143 @@ void adminApproveTopUps() {
     }
 
     db.loadWallets();
-    Wallet &central = db.wallets.at(0);
-    ofstream temp("topup_requests_temp.db");
+    TopUpApproval result = pipeline.approveTopUps([&](const TopUpRequest &r) {
+        return (choice == 1 && r.wallet_id == selectedWalletID) ||
+               (choice == 2 && r.request_id == selectedRequestID);
+    }).get();
+
+    for (const auto& r : result.missingWallet)
+        printWarning("Wallet ID " + to_string(r.wallet_id) + " not found. Request skipped.");
+    for (const auto& r : result.duplicates)
+        printWarning("Request " + r.request_id + " was already approved. Duplicate removed.");
+    for (const auto& r : result.insufficientFunds)
+        printWarning("Insufficient central balance for wallet " + to_string(r.wallet_id) + ". Request kept pending.");
+    for (const auto& r : result.approved)
+        printSuccess("Approved top-up of " + to_string(r.amount) + " to wallet " + to_string(r.wallet_id) + ".");
+    
+    cout << endl;
+    cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cin.get();
+}
 
-    vector<Request> approved;
+// Admin: latency counters for the core operations, also exported for Prometheus
+void viewMetrics() {
+    clearScreen();
+    printHeader("PERFORMANCE METRICS");
+    cout << endl;
 
-    // Simulate approval decisions
-    for (const auto& r : allRequests) {
-        bool shouldApprove = false;
-
-        if (choice == 1 && r.wallet_id == selectedWalletID)
-            shouldApprove = true;
-        else if (choice == 2 && r.request_id == selectedRequestID)
-            shouldApprove = true;
-
-        if (shouldApprove) {
-            if (!db.wallets.count(r.wallet_id)) {
-                printWarning("Wallet ID " + to_string(r.wallet_id) + " not found. Request skipped.");
-                temp << r.request_id << " " << r.wallet_id << " " << r.amount << " " << r.timestamp << "\n";
-                continue;
-            }
-            if (central.balance < r.amount) {
-                printWarning("Insufficient central balance for wallet " + to_string(r.wallet_id) + ". Request kept pending.");
-                temp << r.request_id << " " << r.wallet_id << " " << r.amount << " " << r.timestamp << "\n";
-                continue;
-            }
-            approved.push_back(r);
-        } else {
-            temp << r.request_id << " " << r.wallet_id << " " << r.amount << " " << r.timestamp << "\n";
-        }
+    cout << Metrics::report() << endl;
+    if (Metrics::writePrometheus("metrics.prom")) {
+        printInfo("Metrics exported to metrics.prom (Prometheus text format).");
+    } else {
+        printError("Failed to write metrics.prom.");
     }
 
-    // Apply changes for approved ones
-    for (const auto& r : approved) {
-        Wallet &target = db.wallets.at(r.wallet_id);
-        central.balance -= r.amount;
-        target.balance += r.amount;
+    cout << endl;
+    cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cin.get();
+}
 
-        central.log("Debited " + to_string(r.amount) + " to wallet " + to_string(r.wallet_id));
-        target.log("Received " + to_string(r.amount) + " from central");
+// Admin: standing orders run by the scheduler
+void manageStandingOrders() {
+    clearScreen();
+    printHeader("SCHEDULED TRANSFERS");
+    cout << endl;
 
-        printSuccess("Approved top-up of " + to_string(r.amount) + " to wallet " + to_string(r.wallet_id) + ".");
+    vector<StandingOrder> orders = scheduler.orders();
+    if (orders.empty()) printInfo("No scheduled transfers.");
+    for (const auto &o : orders) {
+        time_t next = o.due();
+        cout << Colors::BRIGHT_CYAN << "#" << o.id << Colors::RESET << " wallet " << o.from << " -> "
+             << (o.to == StandingOrder::kAllMembers ? string("every member") : "wallet " + to_string(o.to)) << ", "
+             << o.amount << " points, " << periodName(o.period);
+        if (o.period != StandingOrder::Once && o.every > 1) cout << " every " << o.every;
+        cout << ", next run " << ctime(&next);
     }
 
-    db.saveWallets();
+    cout << endl;
+    cout << Colors::BRIGHT_CYAN << "1. Add scheduled transfer\n";
+    cout << "2. Cancel scheduled transfer\n";
+    cout << "3. Back\n";
+    cout << "Choose: " << Colors::RESET;
+    int choice;
+    cin >> choice;
+
+    if (choice == 1) {
+        db.loadWallets();
+        StandingOrder o;
+        cout << Colors::BRIGHT_CYAN << "From wallet ID (0 = central): " << Colors::RESET;
+        cin >> o.from;
+        cout << Colors::BRIGHT_CYAN << "To wallet ID (-1 = every member wallet): " << Colors::RESET;
+        cin >> o.to;
+        cout << Colors::BRIGHT_CYAN << "Amount: " << Colors::RESET;
+        cin >> o.amount;
+        cout << Colors::BRIGHT_CYAN << "Repeat (once/daily/weekly/monthly): " << Colors::RESET;
+        string period;
+        cin >> period;
+        if (cin.fail() || !parsePeriod(period, o.period)) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            printError("Invalid input.");
+            return;
+        }
+        if (o.period != StandingOrder::Once) {
+            cout << Colors::BRIGHT_CYAN << "Every how many " << (o.period == StandingOrder::Daily ? "days" :
+                                                                   o.period == StandingOrder::Weekly ? "weeks" : "months")
+                 << ": " << Colors::RESET;
+            cin >> o.every;
+        }
+        cout << Colors::BRIGHT_CYAN << "First run (YYYY-MM-DD HH:MM, or now): " << Colors::RESET;
+        string date;
+        cin >> date;
+        if (date == "now") {
+            o.start = Env::now();
+        } else {
+            string hm;
+            cin >> hm;
+            tm t = {};
+            if (sscanf(date.c_str(), "%d-%d-%d", &t.tm_year, &t.tm_mon, &t.tm_mday) != 3 ||
+                sscanf(hm.c_str(), "%d:%d", &t.tm_hour, &t.tm_min) != 2) {
+                printError("Invalid date.");
+                return;
+            }
+            t.tm_year -= 1900;
+            t.tm_mon -= 1;
+            t.tm_isdst = -1;
+            o.start = mktime(&t);
+        }
+
+        if (cin.fail() || o.amount <= 0 || o.every == 0 || o.start < 0) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            printError("Invalid input.");
+            return;
+        }
+        if (!db.wallets.count(o.from) || o.from == o.to ||
+            (o.to != StandingOrder::kAllMembers && !db.wallets.count(o.to))) {
+            printError("Invalid wallet ID.");
+            return;
+        }
+        uint64_t id = scheduler.add(o);
+        pipeline.saveSchedule(scheduler).get();
+        printSuccess("Scheduled transfer #" + to_string(id) + " created.");
+    } else if (choice == 2) {
+        cout << Colors::BRIGHT_CYAN << "Scheduled transfer ID: " << Colors::RESET;
+        uint64_t id;
+        cin >> id;
+        if (cin.fail() || !scheduler.cancel(id)) {
+            cin.clear();
+            printError("Scheduled transfer not found.");
+            return;
+        }
+        pipeline.saveSchedule(scheduler).get();
+        printSuccess("Scheduled transfer #" + to_string(id) + " cancelled.");
+    } else {
+        return;
+    }
 
-    temp.close();
-    remove("topup_requests.db");
-    rename("topup_requests_temp.db", "topup_requests.db");
-    
     cout << endl;
     cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
@@ -703,8 +707,9 @@ void adminApproveTopUps() {
 // Menu for regular users
 void userMenu(User &user) {
     while (true) {
+        runScheduledTransfers();
         clearScreen();
-        printHeader("USER DASHBOARD - " + user.username);
+        printHeader("USER DASHBOARD - " + string(user.username));
         cout << endl;
         
         cout << Colors::SECONDARY << "Welcome, " << Colors::SUCCESS << user.full_name << Colors::RESET << "!" << endl;
@@ -766,36 +771,24 @@ void userMenu(User &user) {
                 printSubHeader("PENDING UPDATE REQUESTS");
 
                 // Đọc và hiển thị danh sách yêu cầu
-                ifstream fin("admin_update_requests.db");
-                if (!fin) {
+                string buf;
+                if (!TextLoader::readFile("admin_update_requests.db", buf)) {
                     printWarning("No pending update requests found.");
                     break;
                 }
 
-                string line;
-                vector<string> availableOtps;
-                vector<string> requestLines;
-
-                while (getline(fin, line)) {
-                    stringstream ss(line);
-                    string otp, username, fullname;
-                    getline(ss, otp, '|');
-                    getline(ss, username, '|');
-                    getline(ss, fullname);
-
+                size_t requestCount = 0;
+                TextLoader::forEachUpdateRequest(buf, [&](string_view, string_view otp, string_view username, string_view fullname) {
                     if (username == user.username) {
                         cout << Colors::BRIGHT_CYAN << "Username: " << Colors::RESET << username << endl;
                         cout << Colors::BRIGHT_CYAN << "New Fullname: " << Colors::RESET << fullname << endl;
                         cout << Colors::BRIGHT_CYAN << "OTP: " << Colors::BRIGHT_YELLOW << otp << Colors::RESET << endl;
                         cout << Colors::YELLOW << "=================================================================" << Colors::RESET << endl;
                     }
+                    requestCount++;
+                });
 
-                    availableOtps.push_back(otp);
-                    requestLines.push_back(line);
-                }
-                fin.close();
-
-                if (availableOtps.empty()) {
+                if (requestCount == 0) {
                     printWarning("No pending requests found.");
                     break;
                 }
@@ -808,20 +801,14 @@ void userMenu(User &user) {
                 ofstream fout("temp_admin_update_requests.db");
                 bool found = false;
 
-                for (const string &entry : requestLines) {
-                    stringstream ss(entry);
-                    string otp, username, fullname;
-                    getline(ss, otp, '|');
-                    getline(ss, username, '|');
-                    getline(ss, fullname);
-
+                TextLoader::forEachUpdateRequest(buf, [&](string_view entry, string_view otp, string_view username, string_view fullname) {
                     if (otp == otp_input && username == user.username) {
                         db.loadUsers();
                         auto user_it = db.users.find(username);
                         if (user_it != db.users.end()) {
-                            user_it->second.full_name = fullname;
+                            db.setFullName(user_it->second, fullname);
                             db.saveUsers();
-                            printSuccess("Updated successfully for user '" + username + "'.");
+                            printSuccess("Updated successfully for user '" + string(username) + "'.");
                         } else {
                             printError("User not found in database.");
                         }
@@ -830,7 +817,7 @@ void userMenu(User &user) {
                     } else {
                         fout << entry << "\n"; // Giữ lại dòng chưa xử lý
                     }
-                }
+                });
 
                 fout.close();
 
@@ -857,11 +844,55 @@ void userMenu(User &user) {
     }
 }
 
+// Admin: create many users from a file in one go
+void adminProvisionUsers() {
+    clearScreen();
+    printHeader("BULK PROVISION USERS");
+    cout << endl;
+
+    cout << Colors::BRIGHT_CYAN << "File of users (<username> <full_name> [password] per line): " << Colors::RESET;
+    string path;
+    cin >> path;
+    vector<NewUser> batch;
+    vector<pair<size_t, string>> rejected;
+    if (!readProvisionFile(path, batch, rejected)) {
+        printError("Cannot read " + path + ".");
+        return;
+    }
+
+    string out = path + ".credentials";
+    auto start = chrono::steady_clock::now();
+    ProvisionResult result = db.provisionUsers(batch, out);
+    long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    rejected.insert(rejected.end(), result.rejected.begin(), result.rejected.end());
+    sort(rejected.begin(), rejected.end());
+
+    if (!result.saved) {
+        printError("Could not write " + out + "; no users created.");
+    } else if (!result.created.empty()) {
+        printSuccess("Created " + to_string(result.created.size()) + " users with wallets " +
+                     to_string(result.created.front().wallet_id) + "-" + to_string(result.created.back().wallet_id) +
+                     " in " + to_string(ms) + " ms.");
+        printInfo("Generated passwords written to " + out + "; hand them out and delete the file.");
+    } else {
+        printInfo("No users created.");
+    }
+    for (size_t i = 0; i < rejected.size() && i < 10; ++i)
+        printWarning("Line " + to_string(rejected[i].first) + ": " + rejected[i].second + ".");
+    if (rejected.size() > 10) printWarning("... and " + to_string(rejected.size() - 10) + " more lines rejected.");
+
+    cout << endl;
+    cout << Colors::BRIGHT_CYAN << "Press Enter to continue..." << Colors::RESET;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cin.get();
+}
+
 // Menu for admin users
 void adminMenu(User &user) {
     while (true) {
+        runScheduledTransfers();
         clearScreen();
-        printHeader("ADMIN DASHBOARD - " + user.username);
+        printHeader("ADMIN DASHBOARD - " + string(user.username));
         cout << endl;
         
         cout << Colors::SECONDARY << "Welcome, " << Colors::SUCCESS << user.full_name << Colors::RESET << "!" << endl;
@@ -876,7 +907,10 @@ void adminMenu(User &user) {
         cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::SECONDARY << "4." << Colors::RESET << " View Central Wallet Balance" << endl;
         cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::SECONDARY << "5." << Colors::RESET << " Top-up User Wallet" << endl;
         cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::SECONDARY << "6." << Colors::RESET << " Approve Top-up Requests" << endl;
-        cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::ERROR << "7." << Colors::RESET << " Logout" << endl;
+        cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::SECONDARY << "7." << Colors::RESET << " View Performance Metrics" << endl;
+        cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::SECONDARY << "8." << Colors::RESET << " Scheduled Transfers" << endl;
+        cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::SECONDARY << "9." << Colors::RESET << " Bulk Provision Users" << endl;
+        cout << Colors::PRIMARY << "|" << Colors::RESET << " " << Colors::ERROR << "10." << Colors::RESET << " Logout" << endl;
         cout << Colors::PRIMARY << "+===============================================================+" << Colors::RESET << endl;
         cout << endl;
         
@@ -893,11 +927,11 @@ void adminMenu(User &user) {
         switch (choice) {
             case 1:
                 printSubHeader("ALL USERS");
-                for (const auto &p : db.users) {
-                    cout << Colors::SECONDARY << "Username: " << Colors::RESET << p.first;
-                    cout << " | " << Colors::WARNING << "Type: " << Colors::RESET << (p.second.is_admin ? "Admin" : "User");
-                    cout << " | " << Colors::SUCCESS << "Name: " << Colors::RESET << p.second.full_name << endl;
-                }
+                db.snapshot().forEachUser([](const UserRow &u) {
+                    cout << Colors::SECONDARY << "Username: " << Colors::RESET << u.username;
+                    cout << " | " << Colors::WARNING << "Type: " << Colors::RESET << (u.is_admin ? "Admin" : "User");
+                    cout << " | " << Colors::SUCCESS << "Name: " << Colors::RESET << u.full_name << endl;
+                });
                 cout << endl;
                 cout << Colors::SECONDARY << "Press Enter to continue..." << Colors::RESET;
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
@@ -944,6 +978,15 @@ void adminMenu(User &user) {
                 adminApproveTopUps();
                 break;
             case 7:
+                viewMetrics();
+                break;
+            case 8:
+                manageStandingOrders();
+                break;
+            case 9:
+                adminProvisionUsers();
+                break;
+            case 10:
                 printSuccess("Logged out successfully!");
                 return;
             default:
@@ -953,7 +996,9 @@ void adminMenu(User &user) {
 }
 
 int main() {
+    scheduler.load();
     while (true) {
+        runScheduledTransfers();
         clearScreen();
         printHeader("WALLET POINTS SYSTEM");
         cout << endl;